@@ -0,0 +1,106 @@
+// Allocator Benchmark
+// -------------------
+// Measures the cost of a node allocation as heap occupancy grows.
+//
+//   gcc -O2 bench/alloc.c -o alloc -lm -lpthread && ./alloc
+//
+// For each occupancy, the node slice is filled at random up to that ratio, as
+// a long-running program leaves it, and a steady churn is timed: each round
+// allocates 4 nodes (like a COMM) and frees 4 random live nodes, so occupancy
+// stays constant. Only the allocation itself is timed, both with the
+// free-stack allocator and with the linear scan it replaced.
+
+#define G_NODE_LEN (1ul << 24)
+#include "../src/hvm.c"
+
+#define ROUNDS (1ul << 20)
+
+// The previous allocator: walks `nput` until it finds empty locations.
+static u32 scan_alloc(Net* net, TM* tm, u32 num) {
+  u32 got = 0;
+  while (got < num) {
+    u32 lc = tm->tid*NODE_SLICE + (tm->nput%NODE_SLICE);
+    tm->nput += 1;
+    if (lc > 0 && node_load(net, lc) == 0) {
+      tm->nloc[got++] = lc;
+    }
+  }
+  return got;
+}
+
+static u64 seed = 0x9E3779B97F4A7C15;
+
+static inline u64 rand64() {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+// Fills the node buffer up to `occ`, returning the live locations.
+static u32 fill(Net* net, u32* live, double occ) {
+  u32 len = 0;
+  for (u32 i = 1; i < G_NODE_LEN; ++i) {
+    if ((rand64() % 10000) < occ * 10000) {
+      node_create(net, i, new_pair(new_port(ERA,0), new_port(ERA,0)));
+      live[len++] = i;
+    } else {
+      node_create(net, i, 0);
+    }
+  }
+  return len;
+}
+
+// Returns the average nanoseconds per allocated node. Only the allocation is
+// timed; the clock's own overhead is measured and subtracted.
+static double churn(Net* net, TM* tm, u32* live, u32 len, bool scan) {
+  tm->nput = NODE_SLICE; // as if the whole slice was handed out once
+  tm->nswp = 0;
+  tm->nfre = 0;
+  u64 clk = time64();
+  for (u32 r = 0; r < ROUNDS; ++r) {
+    time64();
+  }
+  clk = time64() - clk;
+  u64 dur = 0;
+  for (u32 r = 0; r < ROUNDS; ++r) {
+    u64 ini = time64();
+    u32 got = scan ? scan_alloc(net, tm, 4) : node_alloc(net, tm, 4);
+    dur += time64() - ini;
+    for (u32 i = 0; i < got; ++i) {
+      node_create(net, tm->nloc[i], new_pair(new_port(ERA,0), new_port(ERA,0)));
+    }
+    for (u32 i = 0; i < got && len > 0; ++i) {
+      u32 j = rand64() % len;
+      node_take(net, tm, live[j]);
+      live[j] = tm->nloc[i];
+    }
+  }
+  return (double)(dur > clk ? dur - clk : 0) / (ROUNDS * 4);
+}
+
+int main() {
+  OPTS.heap_init = G_NODE_LEN * (sizeof(ANode) + sizeof(APort));
+  Net* net  = net_new();
+  TM*  tm   = tm_new(0);
+  u32* live = malloc(G_NODE_LEN * sizeof(u32));
+  if (!net || !tm || !live || !node_grow(net, tm)) {
+    fprintf(stderr, "failed to allocate the benchmark heap\n");
+    return 1;
+  }
+
+  double occs[] = {0.00, 0.50, 0.75, 0.90, 0.95, 0.99};
+  printf("occupancy   free-stack   linear-scan  (ns/node)\n");
+  for (u32 i = 0; i < sizeof(occs) / sizeof(occs[0]); ++i) {
+    u32 len = fill(net, live, occs[i]);
+    double fs = churn(net, tm, live, len, false);
+    len = fill(net, live, occs[i]);
+    double ls = churn(net, tm, live, len, true);
+    printf("%8.0f%%   %10.2f   %11.2f\n", occs[i] * 100, fs, ls);
+  }
+
+  free(live);
+  free(tm);
+  net_free(net);
+  return 0;
+}
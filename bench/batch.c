@@ -0,0 +1,93 @@
+// Batch Benchmark
+// ---------------
+// Measures interactions per second with `--batch K` as the heap outgrows the
+// last-level cache.
+//
+//   gcc -O2 bench/batch.c -o batch -lm -lpthread && ./batch
+//
+// For each heap size, the node buffer is filled with CON nodes and paired at
+// random into CON~CON redexes, so every interaction touches two cold lines,
+// like a large net whose redexes are scattered across the heap. The redexes
+// are then reduced one at a time (K = 1) or in batches of K, with the lines of
+// each batch prefetched before it is reduced.
+
+#define G_NODE_LEN (1ul << 26)
+#include "../src/hvm.c"
+
+static u64 seed = 0x9E3779B97F4A7C15;
+
+static inline u64 rand64() {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+// Fills `len` nodes and pushes them as `len / 2` redexes, in random pairs.
+static void fill(Net* net, TM* tm, u32* locs, u32 len) {
+  for (u32 i = 0; i < len; ++i) {
+    locs[i] = i + 1;
+    node_create(net, i + 1, new_pair(new_port(ERA,0), new_port(ERA,0)));
+  }
+  for (u32 i = len - 1; i > 0; --i) {
+    u32 j = rand64() % (i + 1);
+    u32 t = locs[i];
+    locs[i] = locs[j];
+    locs[j] = t;
+  }
+  tm->nfre = 0;
+  for (u32 i = 0; i + 1 < len; i += 2) {
+    push_redex(net, tm, new_pair(new_port(CON, locs[i]), new_port(CON, locs[i + 1])));
+  }
+}
+
+// Returns the millions of interactions per second, reducing in batches of K.
+static double run(Net* net, TM* tm, Book* book, u32* locs, u32 len, u32 k) {
+  fill(net, tm, locs, len);
+  u64 itrs = tm->itrs;
+  u64 ini  = time64();
+  while (rbag_len(net, tm) > 0) {
+    if (k > 1) {
+      interact_batch(net, tm, book, k);
+    } else {
+      interact(net, tm, book);
+    }
+  }
+  u64 dur = time64() - ini;
+  return (double)(tm->itrs - itrs) / (dur / 1e3);
+}
+
+int main() {
+  OPTS.heap_init = G_NODE_LEN * (sizeof(ANode) + sizeof(APort));
+  Net*  net  = net_new();
+  TM*   tm   = tm_new(0);
+  Book* book = calloc(1, sizeof(Book));
+  u32*  locs = malloc(G_NODE_LEN * sizeof(u32));
+  if (!net || !tm || !book || !locs || !node_grow(net, tm)) {
+    fprintf(stderr, "failed to allocate the benchmark heap\n");
+    return 1;
+  }
+
+  u32 ks[] = {1, 2, 4, 8, 16, 32};
+  u32 nk   = sizeof(ks) / sizeof(ks[0]);
+  printf("%10s", "heap");
+  for (u32 i = 0; i < nk; ++i) {
+    printf("   K=%-4u", ks[i]);
+  }
+  printf("  (MIPS)\n");
+  for (u32 l2 = 16; l2 <= 25; l2 += 1) {
+    u32 len = 1u << l2;
+    printf("%8.1fMB", (double)len * sizeof(ANode) / (1 << 20));
+    for (u32 i = 0; i < nk; ++i) {
+      printf("  %7.1f", run(net, tm, book, locs, len, ks[i]));
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+
+  free(locs);
+  free(book);
+  free(tm);
+  net_free(net);
+  return 0;
+}
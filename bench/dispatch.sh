@@ -0,0 +1,34 @@
+#!/bin/sh
+# Dispatch Benchmark
+# ------------------
+# Compares the C runtime's MIPS with switch dispatch and with threaded
+# (computed-goto) dispatch, on every example with a `main.hvm`.
+#
+#   bench/dispatch.sh [runs] [threads]
+#
+# Uses `hvm` from PATH (override with HVM=...) to generate each example once,
+# then builds it both ways with `cc` (override with CC=...). Thread counts
+# default to the usable cpus.
+
+HVM=${HVM:-hvm}
+CC=${CC:-cc}
+RUNS=${1:-3}
+THREADS=${2:-}
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+for dir in examples/*/; do
+  ex=$(basename "$dir")
+  [ -f "$dir/main.hvm" ] || continue
+  "$HVM" gen-c "$dir/main.hvm" > "$tmp/main.c" || exit 1
+  "$CC" -O2 "$tmp/main.c" -o "$tmp/switch" -lm -lpthread || exit 1
+  "$CC" -O2 -DTHREADED_DISPATCH "$tmp/main.c" -o "$tmp/threaded" -lm -lpthread || exit 1
+  for run in $(seq "$RUNS"); do
+    for mode in switch threaded; do
+      out=$("$tmp/$mode" ${THREADS:+--threads "$THREADS"} < /dev/null) || exit 1
+      printf "%-16s run=%s %-8s MIPS=%s\n" "$ex" "$run" "$mode" \
+        "$(printf "%s\n" "$out" | sed -n 's/^- MIPS: //p')"
+    done
+  done
+done
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Huge Pages Benchmark
+# --------------------
+# Compares the C runtime's MIPS with and without huge pages.
+#
+#   bench/hugepages.sh [runs]
+#
+# Uses `hvm` from PATH (override with HVM=...). The backing actually obtained
+# (hugetlbfs, transparent or none) is reported by the runtime on stderr. To
+# test hugetlbfs, reserve a pool first, e.g.:
+#
+#   echo 2048 | sudo tee /proc/sys/vm/nr_hugepages
+
+HVM=${HVM:-hvm}
+RUNS=${1:-3}
+cd "$(dirname "$0")/.." || exit 1
+
+mips() {
+  "$HVM" run-c "$@" | sed -n 's/^- MIPS: //p'
+}
+
+for ex in sort_bitonic stress; do
+  for mode in off on; do
+    flag=""
+    [ "$mode" = on ] && flag="--hugepages"
+    for run in $(seq "$RUNS"); do
+      printf "%-14s hugepages=%-3s run=%s MIPS=%s\n" "$ex" "$mode" "$run" "$(mips "examples/$ex/main.hvm" $flag)"
+    done
+  done
+done
@@ -0,0 +1,42 @@
+#!/bin/sh
+# 64-bit Ports Benchmark
+# ----------------------
+# Compares the C runtime's MIPS and peak RSS with 32-bit and 64-bit ports.
+#
+#   bench/hvm64.sh [runs]
+#
+# Uses `hvm` from PATH (override with HVM=...) to generate each example once,
+# then builds it both ways with `cc` (override with CC=...). Peak RSS is read
+# from /proc while the program runs.
+
+HVM=${HVM:-hvm}
+CC=${CC:-cc}
+RUNS=${1:-3}
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+# Runs a binary, printing its MIPS and peak RSS (in KB).
+measure() {
+  "$1" > "$tmp/out" &
+  pid=$!
+  peak=0
+  while kill -0 "$pid" 2>/dev/null; do
+    rss=$(awk '/VmHWM/ { print $2 }' "/proc/$pid/status" 2>/dev/null)
+    [ -n "$rss" ] && peak=$rss
+    sleep 0.01
+  done
+  wait "$pid"
+  printf "MIPS=%s RSS=%sKB\n" "$(sed -n 's/^- MIPS: //p' "$tmp/out")" "$peak"
+}
+
+for ex in sort_bitonic sum_tree stress; do
+  "$HVM" gen-c "examples/$ex/main.hvm" > "$tmp/main.c" || exit 1
+  "$CC" -O2 "$tmp/main.c" -o "$tmp/main32" -lm -lpthread || exit 1
+  "$CC" -O2 -DHVM64 "$tmp/main.c" -o "$tmp/main64" -lm -lpthread -latomic || exit 1
+  for bits in 32 64; do
+    for run in $(seq "$RUNS"); do
+      printf "%-14s ports=%s run=%s %s\n" "$ex" "$bits" "$run" "$(measure "$tmp/main$bits")"
+    done
+  done
+done
@@ -0,0 +1,107 @@
+// Operate Benchmark
+// -----------------
+// Measures the throughput of numeric operations, one at a time with `operate`
+// and in batches with `oper_eval` (as `--oper-batch` does).
+//
+//   gcc -O2 bench/operate.c -o operate -lm -lpthread && ./operate
+//
+// Each mix is a random stream of operand pairs, like the OPER redexes of a
+// numeric program: a single op and type, a few of them, or anything.
+
+#include "../src/hvm.c"
+
+#define OPS (1ul << 16)
+#define REPS 256
+
+static u64 seed = 0x9E3779B97F4A7C15;
+
+static inline u64 rand64() {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+// A random nonzero number of a type.
+static Numb rand_num(Tag ty) {
+  switch (ty) {
+    case TY_U24: return new_u24(rand64() % 1000 + 1);
+    case TY_I24: return new_i24(((INum)(rand64() % 1000) + 1) * (rand64() % 2 ? 1 : -1));
+    default:     return new_f24((f32)(rand64() % 2000000) / 1000 - 1000);
+  }
+}
+
+// Fills `a` and `b` with pairs of operands, an op applied to a number, picking
+// each pair's type and op from the given lists.
+static void fill(Numb* a, Numb* b, const Tag* tys, u32 ntys, const Tag* ops, u32 nops) {
+  for (u32 i = 0; i < OPS; ++i) {
+    Tag ty = tys[rand64() % ntys];
+    Tag op = ops[rand64() % nops];
+    a[i] = (rand_num(ty) & ~0x1F) | op;
+    b[i] = rand_num(ty);
+  }
+}
+
+// Returns the millions of operations per second, in batches of `len` (0 = one
+// at a time). Checks the results against `operate`.
+static double run(const Numb* a, const Numb* b, Numb* c, u32 len) {
+  u64 ini = time64();
+  for (u32 r = 0; r < REPS; ++r) {
+    if (len == 0) {
+      for (u32 i = 0; i < OPS; ++i) {
+        c[i] = operate(a[i], b[i]);
+      }
+    } else {
+      for (u32 i = 0; i < OPS; i += len) {
+        oper_eval(len, a + i, b + i, c + i);
+      }
+    }
+  }
+  u64 dur = time64() - ini;
+  for (u32 i = 0; i < OPS; ++i) {
+    Numb x = operate(a[i], b[i]);
+    if (c[i] != x && !(get_typ(x) == TY_F24 && isnan(get_f24(x)) && isnan(get_f24(c[i])))) {
+      fprintf(stderr, "mismatch at %u: %llx != %llx\n", i, (unsigned long long)c[i], (unsigned long long)x);
+      exit(1);
+    }
+  }
+  return (double)OPS * REPS / (dur / 1e3);
+}
+
+int main() {
+  Numb* a = malloc(OPS * sizeof(Numb));
+  Numb* b = malloc(OPS * sizeof(Numb));
+  Numb* c = malloc(OPS * sizeof(Numb));
+
+  const Tag u24[] = {TY_U24};
+  const Tag f24[] = {TY_F24};
+  const Tag all[] = {TY_U24, TY_I24, TY_F24};
+  const Tag add[] = {OP_ADD};
+  const Tag few[] = {OP_ADD, OP_SUB, OP_LT};
+  const Tag any[] = {OP_ADD, OP_SUB, FP_SUB, OP_MUL, OP_DIV, OP_REM, OP_EQ, OP_NEQ, OP_LT, OP_GT, OP_AND, OP_OR, OP_XOR};
+  struct { const char* name; const Tag* tys; u32 ntys; const Tag* ops; u32 nops; } mixes[] = {
+    {"u24 add",  u24, 1, add, 1},
+    {"u24 few",  u24, 1, few, 3},
+    {"f24 add",  f24, 1, add, 1},
+    {"f24 few",  f24, 1, few, 3},
+    {"all few",  all, 3, few, 3},
+    {"all any",  all, 3, any, 13},
+  };
+  u32 lens[] = {0, 16, 64, 256};
+
+  printf("%-10s  %9s  %9s  %9s  %9s  (MOPS)\n", "mix", "scalar", "batch=16", "batch=64", "batch=256");
+  for (u32 m = 0; m < sizeof(mixes) / sizeof(mixes[0]); ++m) {
+    fill(a, b, mixes[m].tys, mixes[m].ntys, mixes[m].ops, mixes[m].nops);
+    printf("%-10s", mixes[m].name);
+    for (u32 l = 0; l < sizeof(lens) / sizeof(lens[0]); ++l) {
+      printf("  %9.1f", run(a, b, c, lens[l]));
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+
+  free(a);
+  free(b);
+  free(c);
+  return 0;
+}
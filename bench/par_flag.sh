@@ -0,0 +1,33 @@
+#!/bin/sh
+# Parallel Flag Benchmark
+# -----------------------
+# Compares `examples/sum_tree` as written, with its fork points flagged
+# parallel (`&!`), against a copy with the flags removed.
+#
+#   bench/par_flag.sh [runs] [threads...]
+#
+# Uses `hvm` from PATH (override with HVM=...). Flagged redexes are handed
+# straight to idle threads; unflagged ones wait to be stolen. Thread counts
+# default to 1, 2, 4 and the usable cpus.
+
+HVM=${HVM:-hvm}
+RUNS=${1:-3}
+[ $# -gt 0 ] && shift
+THREADS=${*:-1 2 4 $(nproc)}
+cd "$(dirname "$0")/.." || exit 1
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+cp examples/sum_tree/main.hvm "$tmp/flagged.hvm"
+sed 's/&!/\& /' examples/sum_tree/main.hvm > "$tmp/unflagged.hvm"
+
+for threads in $THREADS; do
+  for run in $(seq "$RUNS"); do
+    for mode in flagged unflagged; do
+      out=$("$HVM" run-c "$tmp/$mode.hvm" --threads "$threads") || exit 1
+      printf "threads=%-3s run=%s %-9s TIME=%s MIPS=%s\n" "$threads" "$run" "$mode" \
+        "$(printf "%s\n" "$out" | sed -n 's/^- TIME: //p')" \
+        "$(printf "%s\n" "$out" | sed -n 's/^- MIPS: //p')"
+    done
+  done
+done
@@ -1,21 +1,35 @@
 fn main() {
-  let cores = num_cpus::get();
-  let tpcl2 = (cores as f64).log2().floor() as u32;
-
   println!("cargo:rerun-if-changed=src/run.c");
   println!("cargo:rerun-if-changed=src/hvm.c");
   println!("cargo:rerun-if-changed=src/run.cu");
   println!("cargo:rerun-if-changed=src/hvm.cu");
   println!("cargo:rustc-link-arg=-rdynamic");
 
-  match cc::Build::new()
+  // With the hvm64 feature, the C runtime uses 64-bit ports
+  let hvm64 = std::env::var("CARGO_FEATURE_HVM64").is_ok();
+  // With the threaded-dispatch feature, it dispatches redexes with computed gotos
+  let threaded = std::env::var("CARGO_FEATURE_THREADED_DISPATCH").is_ok();
+
+  let mut build = cc::Build::new();
+  build
       .file("src/run.c")
       .opt_level(3)
       .warnings(false)
-      .define("TPC_L2", &*tpcl2.to_string())
-      .define("IO", None)
-      .try_compile("hvm-c") {
-    Ok(_) => println!("cargo:rustc-cfg=feature=\"c\""),
+      .define("IO", None);
+  if hvm64 {
+    build.define("HVM64", None);
+  }
+  if threaded {
+    build.define("THREADED_DISPATCH", None);
+  }
+
+  match build.try_compile("hvm-c") {
+    Ok(_) => {
+      println!("cargo:rustc-cfg=feature=\"c\"");
+      if hvm64 {
+        println!("cargo:rustc-link-lib=atomic");
+      }
+    }
     Err(e) => {
       println!("cargo:warning=\x1b[1m\x1b[31mWARNING: Failed to compile/run.c:\x1b[0m {}", e);
       println!("cargo:warning=Ignoring/run.c and proceeding with build. \x1b[1mThe C runtime will not be available.\x1b[0m");
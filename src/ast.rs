@@ -8,7 +8,7 @@ use std::collections::{BTreeMap, BTreeSet};
 // -----
 
 #[derive(Clone, Hash, PartialEq, Eq, Debug)]
-pub struct Numb(pub u32);
+pub struct Numb(pub hvm::Val);
 
 #[derive(Clone, Hash, PartialEq, Eq, Debug)]
 pub enum Tree {
@@ -113,11 +113,23 @@ impl<'i> CoreParser<'i> {
       hvm::Numb::new_f24(val)
     } else if num.starts_with('+') || num.starts_with('-') {
       *num_parser.index() += 1;
-      let val = num_parser.parse_u64()? as i32;
+      // Literals wider than the numbers (24 bits, or 56 with hvm64) are rejected
+      // rather than wrapped
+      let val = num_parser.parse_u64()?;
+      let max = if num.starts_with('-') { hvm::I24_MIN.unsigned_abs() as u64 } else { hvm::I24_MAX as u64 };
+      if val > max {
+        let msg = format!("i24 literal out of range\n{}", highlight_error(ini, end, self.input));
+        return self.expected_and("number literal", &msg);
+      }
+      let val = val as hvm::INum;
       hvm::Numb::new_i24(if num.starts_with('-') { -val } else { val })
     } else {
-      let val = num_parser.parse_u64()? as u32;
-      hvm::Numb::new_u24(val)
+      let val = num_parser.parse_u64()?;
+      if val > hvm::U24_MAX as u64 {
+        let msg = format!("u24 literal out of range\n{}", highlight_error(ini, end, self.input));
+        return self.expected_and("number literal", &msg);
+      }
+      hvm::Numb::new_u24(val as hvm::UNum)
     }.0))
   }
 
@@ -568,7 +580,7 @@ impl Book {
   /// cloned and can generate seemingly unexpected results, such as placing eraser
   /// nodes in weird places. See HVM issue [#362](https://github.com/HigherOrderCO/HVM/issues/362)
   /// for an example.
-  fn propagate_safety(&self, compiled_book: &mut hvm::Book, lookup: &BTreeMap<String, u32>) {
+  fn propagate_safety(&self, compiled_book: &mut hvm::Book, lookup: &BTreeMap<String, hvm::Val>) {
     let dependents = self.direct_dependents();
     let mut stack: Vec<&str> = Vec::new();
 
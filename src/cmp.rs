@@ -52,45 +52,48 @@ pub fn compile_def(trg: Target, code: &mut String, book: &hvm::Book, tab: usize,
     code.push_str(&format!("{}return interact_eras(net, tm, a, b);\n", indent(tab+2)));
     code.push_str(&format!("{}}}\n", indent(tab+1)));
   }
-  code.push_str(&format!("{}u32 vl = 0;\n", indent(tab+1)));
-  code.push_str(&format!("{}u32 nl = 0;\n", indent(tab+1)));
-
   // Allocs resources (using fast allocator)
-  for i in 0 .. def.vars {
-    code.push_str(&format!("{}Val v{:x} = vars_alloc_1(net, tm, &vl);\n", indent(tab+1), i));
-  }
-  for i in 0 .. def.node.len() {
-    code.push_str(&format!("{}Val n{:x} = node_alloc_1(net, tm, &nl);\n", indent(tab+1), i));
-  }
-  code.push_str(&format!("{}if (0", indent(tab+1)));
-  for i in 0 .. def.vars {
-    code.push_str(&format!(" || !v{:x}", i));
-  }
-  for i in 0 .. def.node.len() {
-    code.push_str(&format!(" || !n{:x}", i));
+  if trg == Target::CUDA {
+    code.push_str(&format!("{}u32 vl = 0;\n", indent(tab+1)));
+    code.push_str(&format!("{}u32 nl = 0;\n", indent(tab+1)));
+    for i in 0 .. def.vars {
+      code.push_str(&format!("{}Val v{:x} = vars_alloc_1(net, tm, &vl);\n", indent(tab+1), i));
+    }
+    for i in 0 .. def.node.len() {
+      code.push_str(&format!("{}Val n{:x} = node_alloc_1(net, tm, &nl);\n", indent(tab+1), i));
+    }
+    code.push_str(&format!("{}if (0", indent(tab+1)));
+    for i in 0 .. def.vars {
+      code.push_str(&format!(" || !v{:x}", i));
+    }
+    for i in 0 .. def.node.len() {
+      code.push_str(&format!(" || !n{:x}", i));
+    }
+    code.push_str(&format!(") {{\n"));
+    code.push_str(&format!("{}return false;\n", indent(tab+2)));
+    code.push_str(&format!("{}}}\n", indent(tab+1)));
+
+  // Allocs resources (using the thread's free stacks)
+  } else {
+    code.push_str(&format!("{}if (!get_resources(net, tm, {}, {}, {})) {{\n", indent(tab+1), def.rbag.len()+1, def.node.len(), def.vars));
+    code.push_str(&format!("{}return false;\n", indent(tab+2)));
+    code.push_str(&format!("{}}}\n", indent(tab+1)));
+    // Profiles the call (see `--profile`)
+    code.push_str(&format!("{}PROBE2(call, tm->tid, {});\n", indent(tab+1), fid));
+    code.push_str(&format!("{}if (tm->prof) {{\n", indent(tab+1)));
+    code.push_str(&format!("{}prof_call(tm, {});\n", indent(tab+2), fid));
+    code.push_str(&format!("{}}}\n", indent(tab+1)));
+    for i in 0 .. def.node.len() {
+      code.push_str(&format!("{}Val n{:x} = tm->nloc[0x{:x}];\n", indent(tab+1), i, i));
+    }
+    for i in 0 .. def.vars {
+      code.push_str(&format!("{}Val v{:x} = tm->vloc[0x{:x}];\n", indent(tab+1), i, i));
+    }
   }
-  code.push_str(&format!(") {{\n"));
-  code.push_str(&format!("{}return false;\n", indent(tab+2)));
-  code.push_str(&format!("{}}}\n", indent(tab+1)));
   for i in 0 .. def.vars {
     code.push_str(&format!("{}vars_create(net, v{:x}, NONE);\n", indent(tab+1), i));
   }
 
-  // Allocs resources (using slow allocator)
-  //code.push_str(&format!("{}// Allocates needed resources.\n", indent(tab+1)));
-  //code.push_str(&format!("{}if (!get_resources(net, tm, {}, {}, {})) {{\n", indent(tab+1), def.rbag.len()+1, def.node.len(), def.vars));
-  //code.push_str(&format!("{}return false;\n", indent(tab+2)));
-  //code.push_str(&format!("{}}}\n", indent(tab+1)));
-  //for i in 0 .. def.node.len() {
-    //code.push_str(&format!("{}Val n{:x} = tm->nloc[0x{:x}];\n", indent(tab+1), i, i));
-  //}
-  //for i in 0 .. def.vars {
-    //code.push_str(&format!("{}Val v{:x} = tm->vloc[0x{:x}];\n", indent(tab+1), i, i));
-  //}
-  //for i in 0 .. def.vars {
-    //code.push_str(&format!("{}vars_create(net, v{:x}, NONE);\n", indent(tab+1), i));
-  //}
-
   // Compiles root
   compile_link_fast(trg, code, book, neo, tab+1, def, def.root, "b");
 
@@ -142,13 +145,13 @@ pub fn compile_link_fast(trg: Target, code: &mut String, book: &hvm::Book, neo:
         code.push_str(&format!("{}//fast switch\n", indent(tab)));
         code.push_str(&format!("{}if (get_tag({}) == CON) {{\n", indent(tab), b));
         code.push_str(&format!("{}{} = node_load(net, get_val({}));\n", indent(tab+1), &bv, b)); // recycled
-        code.push_str(&format!("{}{} = enter(net,get_fst({}));\n", indent(tab+1), &nu, &bv));
+        code.push_str(&format!("{}{} = enter(net, tm, get_fst({}));\n", indent(tab+1), &nu, &bv));
         code.push_str(&format!("{}if (get_tag({}) == NUM) {{\n", indent(tab+1), &nu));
         code.push_str(&format!("{}tm->itrs += 3;\n", indent(tab+2)));
-        code.push_str(&format!("{}vars_take(net, v{});\n", indent(tab+2), a2.get_val()));
+        code.push_str(&format!("{}vars_take(net, tm, v{});\n", indent(tab+2), a2.get_val()));
         code.push_str(&format!("{}{} = 1;\n", indent(tab+2), &op));
         code.push_str(&format!("{}if (get_u24(get_val({})) == 0) {{\n", indent(tab+2), &nu));
-        code.push_str(&format!("{}node_take(net, get_val({}));\n", indent(tab+3), b));
+        code.push_str(&format!("{}node_take(net, tm, get_val({}));\n", indent(tab+3), b));
         code.push_str(&format!("{}{} = get_snd({});\n", indent(tab+3), &x1, &bv));
         code.push_str(&format!("{}{} = new_port(ERA,0);\n", indent(tab+3), &x2));
         code.push_str(&format!("{}}} else {{\n", indent(tab+2)));
@@ -167,6 +170,10 @@ pub fn compile_link_fast(trg: Target, code: &mut String, book: &hvm::Book, neo:
         code.push_str(&format!("{}node_create(net, n{:x}, new_pair(new_port(CON,n{}),new_port(VAR,v{})));\n", indent(tab+1), a1.get_val(), a11.get_val(), a12.get_val()));
         code.push_str(&format!("{}node_create(net, n{:x}, new_pair({},{}));\n", indent(tab+1), a11.get_val(), &x1, &x2));
         link_or_store(trg, code, book, neo, tab+1, def, &format!("new_port(CON, n{:x})", a.get_val()), b);
+        code.push_str(&format!("{}}} else {{\n", indent(tab)));
+        code.push_str(&format!("{}node_drop(net, tm, n{:x});\n", indent(tab+1), a.get_val()));
+        code.push_str(&format!("{}node_drop(net, tm, n{:x});\n", indent(tab+1), a1.get_val()));
+        code.push_str(&format!("{}node_drop(net, tm, n{:x});\n", indent(tab+1), a11.get_val()));
         code.push_str(&format!("{}}}\n", indent(tab)));
         return;
       }
@@ -196,6 +203,8 @@ pub fn compile_link_fast(trg: Target, code: &mut String, book: &hvm::Book, neo:
     code.push_str(&format!("{}if (!{}) {{\n", indent(tab), &op));
     code.push_str(&format!("{}node_create(net, n{:x}, new_pair({},{}));\n", indent(tab+1), a.get_val(), &x1, &x2));
     link_or_store(trg, code, book, neo, tab+1, def, &format!("new_port(OPR, n{:x})", a.get_val()), b);
+    code.push_str(&format!("{}}} else {{\n", indent(tab)));
+    code.push_str(&format!("{}node_drop(net, tm, n{:x});\n", indent(tab+1), a.get_val()));
     code.push_str(&format!("{}}}\n", indent(tab)));
     return;
   }
@@ -227,6 +236,8 @@ pub fn compile_link_fast(trg: Target, code: &mut String, book: &hvm::Book, neo:
     code.push_str(&format!("{}if (!{}) {{\n", indent(tab), &op));
     code.push_str(&format!("{}node_create(net, n{:x}, new_pair({},{}));\n", indent(tab+1), a.get_val(), x1, x2));
     link_or_store(trg, code, book, neo, tab+1, def, &format!("new_port(DUP,n{:x})", a.get_val()), b);
+    code.push_str(&format!("{}}} else {{\n", indent(tab)));
+    code.push_str(&format!("{}node_drop(net, tm, n{:x});\n", indent(tab+1), a.get_val()));
     code.push_str(&format!("{}}}\n", indent(tab)));
     return;
   }
@@ -252,7 +263,7 @@ pub fn compile_link_fast(trg: Target, code: &mut String, book: &hvm::Book, neo:
     //code.push_str(&format!("{}atomic_fetch_add(&FAST, 1);\n", indent(tab+1)));
     code.push_str(&format!("{}tm->itrs += 1;\n", indent(tab+1)));
     code.push_str(&format!("{}{} = 1;\n", indent(tab+1), &op));
-    code.push_str(&format!("{}{} = node_take(net, get_val({}));\n", indent(tab+1), &bv, b));
+    code.push_str(&format!("{}{} = node_take(net, tm, get_val({}));\n", indent(tab+1), &bv, b));
     code.push_str(&format!("{}{} = get_fst({});\n", indent(tab+1), x1, &bv));
     code.push_str(&format!("{}{} = get_snd({});\n", indent(tab+1), x2, &bv));
     code.push_str(&format!("{}}}\n", indent(tab)));
@@ -262,6 +273,8 @@ pub fn compile_link_fast(trg: Target, code: &mut String, book: &hvm::Book, neo:
     code.push_str(&format!("{}if (!{}) {{\n", indent(tab), &op));
     code.push_str(&format!("{}node_create(net, n{:x}, new_pair({},{}));\n", indent(tab+1), a.get_val(), x1, x2));
     link_or_store(trg, code, book, neo, tab+1, def, &format!("new_port(CON,n{:x})", a.get_val()), b);
+    code.push_str(&format!("{}}} else {{\n", indent(tab)));
+    code.push_str(&format!("{}node_drop(net, tm, n{:x});\n", indent(tab+1), a.get_val()));
     code.push_str(&format!("{}}}\n", indent(tab)));
     return;
   }
@@ -314,6 +327,9 @@ pub fn compile_node(trg: Target, code: &mut String, book: &hvm::Book, neo: &mut
     return format!("new_port({},n{:x})", compile_tag(trg, a.get_tag()), a.get_val());
   } else if a.is_var() {
     return format!("new_port(VAR,v{:x})", a.get_val());
+  } else if trg == Target::C && a.get_tag() == hvm::NUM && !cfg!(feature = "hvm64") {
+    // 32-bit numbers are widened if the C file is built with HVM64
+    return format!("port_load(0x{:08x})", a.0);
   } else {
     return format!("new_port({},0x{:08x})", compile_tag(trg, a.get_tag()), a.get_val());
   }
@@ -1,12 +1,21 @@
+#define _GNU_SOURCE
+
 #include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
 
 #ifdef DEBUG
   #define debug(...) fprintf(stderr, __VA_ARGS__)
@@ -25,6 +34,8 @@ typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
 typedef  int32_t i32;
+typedef  int64_t i64;
+typedef unsigned __int128 u128;
 typedef    float f32;
 typedef   double f64;
 
@@ -32,33 +43,75 @@ typedef  _Atomic(u8)  a8;
 typedef _Atomic(u16) a16;
 typedef _Atomic(u32) a32;
 typedef _Atomic(u64) a64;
+typedef _Atomic(u128) a128;
 
 // Configuration
 // -------------
 
-// Threads per CPU
-#ifndef TPC_L2
-#define TPC_L2 0
+// Port width: with HVM64, ports are 64-bit and pairs 128-bit, raising the
+// heap limit and widening numbers (see below).
+//#define HVM64
+
+// Dispatch: with THREADED_DISPATCH, redexes are dispatched through a table of
+// computed gotos (a GCC/Clang extension) rather than a switch (see below).
+//#define THREADED_DISPATCH
+
+// Probes: static tracepoints (see PROBE0), for perf, bpftrace and the like.
+// They cost a nop each when nothing is attached. NO_PROBES removes them.
+//#define NO_PROBES
+
+// Threads
+// The thread count (TPC) is picked at startup by `tpc_init`, up to TPC_MAX.
+// Defining TPC_L2 makes 2^TPC_L2 the default, instead of the cpu count.
+#ifndef TPC_MAX
+#define TPC_MAX 1024
 #endif
-#define TPC (1ul << TPC_L2)
+static u32 TPC = 1;
 
 // Types
 // -----
 
 // Local Types
+#ifdef HVM64
+typedef u8   Tag;  // Tag  ::= 3-bit (rounded up to u8)
+typedef u64  Val;  // Val  ::= 61-bit (rounded up to u64)
+typedef u64  Port; // Port ::= Tag + Val (fits a u64)
+typedef u128 Pair; // Pair ::= Port + Port (fits a u128)
+typedef u64  Loc;  // Loc  ::= node or var index (past 4g, see G_NODE_LEN)
+
+// A node is only accessed by the thread holding its redex, so each half of a
+// node can be atomic on its own. Redexes may be stolen, so need a128.
+typedef a64  APort; // atomic Port
+typedef a128 APair; // atomic Pair
+typedef struct { APort fst; APort snd; } ANode; // atomic node
+#else
 typedef u8  Tag;  // Tag  ::= 3-bit (rounded up to u8)
 typedef u32 Val;  // Val  ::= 29-bit (rounded up to u32)
 typedef u32 Port; // Port ::= Tag + Val (fits a u32)
 typedef u64 Pair; // Pair ::= Port + Port (fits a u64)
+typedef u32 Loc;  // Loc  ::= node or var index
 
 typedef a32 APort; // atomic Port
 typedef a64 APair; // atomic Pair
+typedef a64 ANode; // atomic node
+#endif
 
 // Rules
 typedef u8 Rule; // Rule ::= 3-bit (rounded up to 8)
 
 // Numbs
+// With HVM64, the u24/i24 types hold 56-bit integers, and f24 a full f32.
+#ifdef HVM64
+typedef u64 Numb; // Numb ::= 61-bit (rounded up to u64)
+typedef u64 UNum; // unsigned payload
+typedef i64 INum; // signed payload
+#define NUMB_BITS 56
+#else
 typedef u32 Numb; // Numb ::= 29-bit (rounded up to u32)
+typedef u32 UNum; // unsigned payload
+typedef i32 INum; // signed payload
+#define NUMB_BITS 24
+#endif
 
 // Tags
 #define VAR 0x0 // variable
@@ -81,10 +134,10 @@ typedef u32 Numb; // Numb ::= 29-bit (rounded up to u32)
 #define SWIT 0x7
 
 // Numbers
-static const f32 U24_MAX = (f32) (1 << 24) - 1;
+static const f32 U24_MAX = (f32) ((1ull << NUMB_BITS) - 1);
 static const f32 U24_MIN = 0.0;
-static const f32 I24_MAX = (f32) (1 << 23) - 1;
-static const f32 I24_MIN = (f32) (i32) ((-1u) << 23);
+static const f32 I24_MAX = (f32) ((1ull << (NUMB_BITS - 1)) - 1);
+static const f32 I24_MIN = (f32) (i64) ((-1ull) << (NUMB_BITS - 1));
 #define TY_SYM 0x00
 #define TY_U24 0x01
 #define TY_I24 0x02
@@ -110,71 +163,260 @@ static const f32 I24_MIN = (f32) (i32) ((-1u) << 23);
 #define FP_SHR 0x16
 
 // Constants
+#ifdef HVM64
+#define FREE 0x0000000000000000
+#define ROOT 0x0000001FFFFFFFF8
+#define NONE 0xFFFFFFFFFFFFFFFF
+#else
 #define FREE 0x00000000
 #define ROOT 0xFFFFFFF8
 #define NONE 0xFFFFFFFF
+#endif
 
 // Cache Padding
 #define CACHE_PAD 64
 
 // Global Net
-#define HLEN (1ul << 16) // max 16k high-priority redexes
-#define RLEN (1ul << 24) // max 16m low-priority redexes
+#define HLEN (1ul << 16) // max 64k high-priority redexes (more spill to the deque)
+#define RLEN (1ul << 10) // initial low-priority redexes (the deque grows as needed)
+#ifdef HVM64
+#ifndef G_NODE_LEN
+#define G_NODE_LEN (1ul << 34) // max 16g nodes (256 GiB)
+#endif
+#ifndef G_VARS_LEN
+#define G_VARS_LEN (1ul << 34) // max 16g vars
+#endif
+#else
+#ifndef G_NODE_LEN
 #define G_NODE_LEN (1ul << 29) // max 536m nodes
+#endif
+#ifndef G_VARS_LEN
 #define G_VARS_LEN (1ul << 29) // max 536m vars
-#define G_RBAG_LEN (TPC * RLEN)
+#endif
+#endif
 
+// Each thread owns a slice of node_buf and vars_buf. Set by `tpc_init`.
+// Slices are whole huge pages, so each can be committed and bound on its own.
+static u64 NODE_SLICE = G_NODE_LEN;
+static u64 VARS_SLICE = G_VARS_LEN;
+
+// Allocator
+#define FREE_LEN   (1ul << 16) // max recycled locations per thread
+#define FREE_BULK  (1ul << 12) // locations gathered per refill
+
+// Numbs
+#define OPER_BATCH_MAX 256 // max OPER redexes evaluated together (`--oper-batch`)
+#define HEAP_CHUNK (1ul << 16) // min locations committed at once
+
+// Huge Page Backings
+#define HUGE_NONE  0 // regular pages
+#define HUGE_THP   1 // transparent huge pages (madvise)
+#define HUGE_TLB   2 // hugetlbfs pages (MAP_HUGETLB)
+#define HUGE_ALIGN (1ul << 21) // transparent huge page alignment
+#define SLICE_ALIGN (HUGE_ALIGN / sizeof(APort)) // slice alignment, in locations
+#define PAGE_ALIGN (1ul << 12) // regular page alignment
+
+// Steal Levels: idle threads steal from threads sharing their core first,
+// then their last-level cache, NUMA node and socket, then from anyone.
+#define STEAL_CORE   0
+#define STEAL_CACHE  1
+#define STEAL_NODE   2
+#define STEAL_SOCKET 3
+#define STEAL_REMOTE 4
+#define STEAL_LEVELS 5
+
+// Each thread's low-priority redexes are in a Chase-Lev work-stealing deque:
+// the owner pushes and pops at `bot`, thieves take from `top`. Both only
+// grow, and index a ring modulo its length. When the ring fills, the owner
+// moves the deque to one twice as long. Thieves may still read the old ring,
+// which is left unchanged until the normalization ends.
+typedef struct Ring {
+  u64          len; // length, a power of two
+  struct Ring* old; // previous ring, freed when the normalization ends
+  APair        buf[]; // redexes
+} Ring;
+
+typedef struct {
+  a64            top; // next redex to steal
+  char           pad[CACHE_PAD - sizeof(a64)];
+  a64            bot; // next redex to push
+  _Atomic(Ring*) ring; // current ring
+  char           end[CACHE_PAD - sizeof(a64) - sizeof(Ring*)];
+} Deque;
+
+// An idle thread spinning for work opens its inbox, and a thread pushing a
+// parallel (`&!`) redex hands it straight to the nearest open inbox.
+typedef struct {
+  APair redex; // the handed redex, or 0
+  a32  open; // accepting a redex
+  char pad[CACHE_PAD - sizeof(APair) - sizeof(a32)];
+} Inbox;
+
+// Evaluator Statistics (`--stats`)
+// Each thread counts on its own TM, which no other thread writes to, so this
+// is cheap enough to always do. `normalize` sums them up on the Net.
+typedef struct {
+  u64 rule[8]; // interactions per rule
+  u64 fail[8]; // interactions that failed and were pushed back, per rule
+  u64 steal_try; // victims probed by `steal`
+  u64 steal_hit; // probes that got redexes
+  u64 link; // `link` calls
+  u64 link_hops; // vars they followed
+  u64 enter; // `enter` calls
+  u64 enter_hops; // vars they followed
+  u64 alloc; // node and vars locations allocated
+  u64 probe; // locations probed to find them
+} Stats;
+
+// The buffers are reserved up-front, but each thread's slice of node_buf and
+// vars_buf is only committed as it fills, within the `--heap` budget.
 typedef struct Net {
-  APair node_buf[G_NODE_LEN]; // global node buffer
-  APort vars_buf[G_VARS_LEN]; // global vars buffer
-  APair rbag_buf[G_RBAG_LEN]; // global rbag buffer
+  ANode* node_buf; // global node buffer
+  APort* vars_buf; // global vars buffer
+  u64 heap_max; // heap budget, in bytes
+  u8  huge; // huge page backing (HUGE_*)
+  a32 sched; // scheduling level (SCHED_*)
+  a64 nodes; // live nodes, as published by the threads
+  a64 heap_len; // committed heap, in bytes
+  u64 live; // live nodes after the last compaction
   a64 itrs; // interaction count
+  a64 stls[STEAL_LEVELS]; // steal count per level
+  a64 give; // parallel redexes handed off
+  a64 peak; // peak live nodes, as published by the threads
+  a64 heap_peak; // peak committed heap, in bytes
+  u64 io_time; // time spent in IO calls, in ns (see `do_run_io`)
+  Stats stat; // statistics, summed by `normalize`
+  u64 tstat[TPC_MAX]; // interactions per thread, likewise
   a32 idle; // idle thread counter
+  a32 done; // set when all threads are idle
+  a32 park; // futex idle threads sleep on, bumped to wake them
+  a32 sleep; // idle threads sleeping on `park`
+  Deque deqs[TPC_MAX]; // low-priority redexes
+  Inbox inbox[TPC_MAX]; // parallel redex handoffs
 } Net;
 
-#define DEF_RBAG_LEN 0xFFF
-#define DEF_NODE_LEN 0xFFF
-
 // Top-Level Definition
 typedef struct Def {
-  char name[256];
+  u32  name; // offset of the name in the book's name_buf
   bool safe;
   u32  rbag_len;
   u32  node_len;
   u32  vars_len;
   Port root;
-  Pair node_buf[DEF_NODE_LEN];
-  Pair rbag_buf[DEF_RBAG_LEN];
+  Pair data[]; // rbag_buf, then node_buf
 } Def;
 
 typedef struct Book Book;
 
 // A Foreign Function
 typedef struct {
-  char name[256];
+  const char* name;
   Port (*func)(Net*, Book*, Port);
 } FFn;
 
 // Book of Definitions
+// Defs are packed back to back in `defs_buf`, in the order they're reached
+// from main, so callers sit near their callees. Names, which are only needed
+// to print, are kept apart in `name_buf`.
 typedef struct Book {
-  u32 defs_len;
-  Def defs_buf[0x4000];
-  u32 ffns_len;
-  FFn ffns_buf[0x4000];
+  u32   defs_len; // number of defs
+  u64*  defs_off; // offset of each def in defs_buf
+  u8*   defs_buf; // packed defs
+  u64   defs_size; // size of defs_buf, in bytes
+  char* name_buf; // def names, null-terminated
+  u32   ffns_len;
+  u32   ffns_cap;
+  FFn*  ffns_buf;
 } Book;
 
+// Max nodes or vars allocated by one interaction. Grows with the book's
+// largest def.
+static u32 LOC_LEN = 0xFFF;
+
+// Call Profile (`--profile`)
+// Each thread grows a tree of the calls it made, where a def's caller is the
+// def whose call this thread expanded last, and recursion folds back onto the
+// ancestor already running the same def. Interactions are charged to the node
+// that was current when they happened, so the subtree of a call holds the
+// interactions that descended from it.
+#define PROF_LEN (1 << 16) // max tree nodes per thread
+#define PROF_ROOT 0xFFFFFFFF // fid of the root, before any call
+
+typedef struct {
+  u64* defs; // calls per def
+  u32  len; // tree nodes used
+  u32  ctx; // current node
+  u32  mark; // `itrs` when `ctx` was last charged
+  u32  fid[PROF_LEN]; // def of each node
+  u32  up[PROF_LEN]; // parent
+  u32  kid[PROF_LEN]; // first child (0 = none)
+  u32  sib[PROF_LEN]; // next sibling (0 = none)
+  u64  calls[PROF_LEN]; // calls through this path
+  u64  itrs[PROF_LEN]; // interactions charged here
+} Prof;
+
+// Timeline Trace (`--trace`)
+// Each thread records what it was doing as spans on a ring, which keeps the
+// last TRACE_LEN of them. The main thread has its own, for normalizations and
+// IO calls.
+#define TRACE_LEN (1 << 16) // spans kept per thread
+
+// Span Kinds
+#define TRACE_BUSY 0 // reducing redexes
+#define TRACE_IDLE 1 // out of redexes, stealing or parked
+#define TRACE_SYNC 2 // waiting for the other threads in `sync_threads`
+#define TRACE_NORM 3 // a `normalize` call
+#define TRACE_IO   4 // an IO call (arg: index in the book's ffns_buf)
+
+typedef struct {
+  u64 ini; // start, in ns
+  u64 end; // end, in ns
+  u32 kind; // TRACE_*
+  u32 arg; // kind-specific
+} Span;
+
+typedef struct {
+  u64  len; // spans recorded, including those overwritten
+  Span buf[TRACE_LEN];
+} Trace;
+
 // Local Thread Memory
 typedef struct TM {
   u32  tid; // thread id
   u32  itrs; // interaction count
-  u32  nput; // next node allocation attempt index
-  u32  vput; // next vars allocation attempt index
+  Loc  nput; // next fresh node index
+  Loc  vput; // next fresh vars index
+  Loc  nswp; // next node sweep index
+  Loc  vswp; // next vars sweep index
+  Loc  nlim; // committed node slice length
+  Loc  vlim; // committed vars slice length
   u32  hput; // next hbag push index
-  u32  rput; // next rbag push index
-  u32  sidx; // steal index
-  u32  nloc[0xFFF]; // global node allocation indices
-  u32  vloc[0xFFF]; // global vars allocation indices
-  Pair hbag_buf[HLEN]; // high-priority redexes
+  u32  mput; // next mbag push index, from the end of hbag_buf
+  i32  nliv; // nodes allocated minus taken, not yet published
+  u32  seed; // victim selection rng state
+  u32  vend[STEAL_LEVELS]; // end of each level's victims in vics_buf
+  u32  stls[STEAL_LEVELS]; // steal count per level
+  u32  give; // parallel redexes handed off
+  bool open; // inbox open
+  Loc* nloc; // global node allocation indices (LOC_LEN)
+  Loc* vloc; // global vars allocation indices (LOC_LEN)
+  u32  nfre; // node free-stack length
+  u32  vfre; // vars free-stack length
+  Loc  nfre_buf[FREE_LEN]; // recycled node locations
+  Loc  vfre_buf[FREE_LEN]; // recycled vars locations
+  Pair hbag_buf[HLEN]; // high-priority redexes (hbag up, mbag down)
+  u32  vics_buf[TPC_MAX]; // other threads, nearest first
+  u32  olen; // deferred OPER redexes
+  Numb oper_a[OPER_BATCH_MAX]; // their operands
+  Numb oper_b[OPER_BATCH_MAX];
+  Port oper_out[OPER_BATCH_MAX]; // where their results go
+  Stats stat; // statistics
+  Prof* prof; // call profile, when profiling
+  Trace* trace; // timeline, when tracing
+  Loc  nmax; // peak nput, across compactions
+  Loc  vmax; // peak vput, likewise
+  u32  hmax; // peak hbag and mbag redexes
+  u32  rmax; // peak redexes, counting the deque (taken as it grows)
 } TM;
 
 // Debugger
@@ -209,16 +451,18 @@ static inline Val get_val(Port port) {
 // Pair: Constructor and Getters
 // -----------------------------
 
+#define PORT_BITS (sizeof(Port) * 8)
+
 static inline const Pair new_pair(Port fst, Port snd) {
-  return ((u64)snd << 32) | fst;
+  return ((Pair)snd << PORT_BITS) | fst;
 }
 
 static inline Port get_fst(Pair pair) {
-  return pair & 0xFFFFFFFF;
+  return (Port)pair;
 }
 
 static inline Port get_snd(Pair pair) {
-  return pair >> 32;
+  return pair >> PORT_BITS;
 }
 
 Pair set_par_flag(Pair pair) {
@@ -262,24 +506,108 @@ static inline u32 min(u32 a, u32 b) {
   return (a < b) ? a : b;
 }
 
+static inline u64 min64(u64 a, u64 b) {
+  return (a < b) ? a : b;
+}
+
+// Raises an atomic to `x`, if below it.
+static inline void atomic_max(a64* a, u64 x) {
+  u64 old = atomic_load_explicit(a, memory_order_relaxed);
+  while (old < x && !atomic_compare_exchange_weak_explicit(a, &old, x, memory_order_relaxed, memory_order_relaxed));
+}
+
 static inline f32 clamp(f32 x, f32 min, f32 max) {
   const f32 t = x < min ? min : x;
   return (t > max) ? max : t;
 }
 
-// A simple spin-wait barrier using atomic operations
-a64 a_reached = 0; // number of threads that reached the current barrier
-a64 a_barrier = 0; // number of barriers passed during this program
+// Static Tracepoints
+// On Linux, each probe is a nop plus a SystemTap SDT note (the format of
+// <sys/sdt.h>, which isn't always installed) naming the `hvm` provider, the
+// probe and where its arguments are, all 64-bit. Tracers find the probes in
+// the binary and patch the nops when attached, e.g.:
+//
+//   bpftrace -e 'usdt:./main:hvm:call { @[arg1] = count(); }'
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__)) && !defined(NO_PROBES)
+#define PROBE_ASM(name, args) \
+  "990: nop\n" \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+  ".balign 4\n" \
+  ".4byte 992f-991f, 994f-993f, 3\n" \
+  "991: .asciz \"stapsdt\"\n" \
+  "992: .balign 4\n" \
+  "993: .8byte 990b\n" \
+  ".8byte _.stapsdt.base\n" \
+  ".8byte 0\n" \
+  ".asciz \"hvm\"\n" \
+  ".asciz \"" #name "\"\n" \
+  ".asciz \"" args "\"\n" \
+  "994: .balign 4\n" \
+  ".popsection\n" \
+  ".ifndef _.stapsdt.base\n" \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n" \
+  ".hidden _.stapsdt.base\n" \
+  "_.stapsdt.base: .space 1\n" \
+  ".size _.stapsdt.base, 1\n" \
+  ".popsection\n" \
+  ".endif\n"
+#define PROBE_ARG(x) "nor"((u64)(x))
+#define PROBE0(name) __asm__ __volatile__(PROBE_ASM(name, ""))
+#define PROBE1(name, a) __asm__ __volatile__(PROBE_ASM(name, "8@%0") :: PROBE_ARG(a))
+#define PROBE2(name, a, b) __asm__ __volatile__(PROBE_ASM(name, "8@%0 8@%1") :: PROBE_ARG(a), PROBE_ARG(b))
+#define PROBE3(name, a, b, c) __asm__ __volatile__(PROBE_ASM(name, "8@%0 8@%1 8@%2") :: PROBE_ARG(a), PROBE_ARG(b), PROBE_ARG(c))
+#define PROBE4(name, a, b, c, d) __asm__ __volatile__(PROBE_ASM(name, "8@%0 8@%1 8@%2 8@%3") :: PROBE_ARG(a), PROBE_ARG(b), PROBE_ARG(c), PROBE_ARG(d))
+#else
+#define PROBE0(name)
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#define PROBE4(name, a, b, c, d)
+#endif
+
+// Declared here, since unistd.h's `link` clashes with ours.
+long syscall(long number, ...);
+
+// Spins before parking on a futex.
+#define SPIN_LEN 256
+
+// Hints the cpu that we're spinning.
+static inline void cpu_relax() {
+  #if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+  #elif defined(__aarch64__)
+  __asm__ volatile("yield");
+  #endif
+}
+
+// Sleeps while `*addr == val`, for at most `ns` nanoseconds (0 = forever).
+static inline void futex_wait(a32* addr, u32 val, u64 ns) {
+  struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, ns ? &ts : NULL, NULL, 0);
+}
+
+// Wakes up to `num` threads sleeping on `addr`.
+static inline void futex_wake(a32* addr, u32 num) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+// A barrier: threads spin briefly, then sleep until the last one arrives.
+a32 a_reached = 0; // number of threads that reached the current barrier
+a32 a_barrier = 0; // number of barriers passed during this program
 void sync_threads() {
-  u64 barrier_old = atomic_load_explicit(&a_barrier, memory_order_relaxed);
-  if (atomic_fetch_add_explicit(&a_reached, 1, memory_order_relaxed) == (TPC - 1)) {
+  u32 barrier_old = atomic_load_explicit(&a_barrier, memory_order_acquire);
+  if (atomic_fetch_add_explicit(&a_reached, 1, memory_order_acq_rel) == (TPC - 1)) {
     // Last thread to reach the barrier resets the counter and advances the barrier
     atomic_store_explicit(&a_reached, 0, memory_order_relaxed);
     atomic_store_explicit(&a_barrier, barrier_old + 1, memory_order_release);
+    futex_wake(&a_barrier, INT_MAX);
   } else {
-    u32 tries = 0;
+    for (u32 i = 0; i < SPIN_LEN && atomic_load_explicit(&a_barrier, memory_order_acquire) == barrier_old; ++i) {
+      cpu_relax();
+    }
     while (atomic_load_explicit(&a_barrier, memory_order_acquire) == barrier_old) {
-      sched_yield();
+      futex_wait(&a_barrier, barrier_old, 0);
     }
   }
 }
@@ -302,6 +630,261 @@ static inline u64 time64() {
   return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
 }
 
+// Options
+// -------
+
+// Pinning Policies (`--pin`)
+#define PIN_NONE    0 // threads float, or stay on their NUMA node
+#define PIN_COMPACT 1 // fill each core, then each cache, node and socket
+#define PIN_CORES   2 // like compact, but one thread per core before SMT siblings
+#define PIN_SCATTER 3 // spread consecutive threads as far apart as possible
+
+// Scheduling Policies (`--sched`)
+#define SCHED_FIXED    0 // same redex order at any heap occupancy
+#define SCHED_ADAPTIVE 1 // more depth-first as occupancy crosses the watermarks
+#define SCHED_DEPTH    2 // always the most depth-first order
+
+// Run Report Formats (`--report`)
+#define REPORT_TEXT 0 // `- ITRS: ...` lines
+#define REPORT_JSON 1 // a JSON object, on one line
+
+typedef struct {
+  u64 heap; // max heap size, in bytes (0 = available memory)
+  u64 heap_init; // initially committed heap, in bytes
+  bool hugepages; // back the heap with huge pages
+  u64 compact; // compact the heap when it spans this many times the live nodes (0 = never)
+  u64 threads; // evaluation threads (0 = HVM_THREADS, else the usable cpus)
+  u8  pin; // pinning policy (PIN_*)
+  u8  sched; // scheduling policy (SCHED_*)
+  u64 sched_low; // occupancy (%) above which the adaptive policy shifts order
+  u64 sched_high; // occupancy (%) above which it shifts further
+  u64 batch; // redexes prefetched and reduced together (1 = one at a time)
+  u64 oper_batch; // ready OPER redexes evaluated together (0 = one at a time)
+  bool stats; // print the evaluator statistics
+  char* profile; // folded call stacks output file (NULL = no profiling)
+  u64 sample; // sampling period, in ms (0 = no sampling)
+  char* sample_file; // sample output file (NULL = stderr)
+  u8  report; // run report format (REPORT_*)
+  char* trace; // timeline output file (NULL = no tracing)
+} Opts;
+
+// Max redexes per batch (`--batch`).
+#define BATCH_MAX 64
+
+static Opts OPTS = {0, 0, false, 2, 0, PIN_NONE, SCHED_ADAPTIVE, 50, 75, 1, 0, false, NULL, 0, NULL, REPORT_TEXT, NULL};
+
+// Parses an unsigned integer. Returns success.
+bool parse_uint(const char* str, u64* out) {
+  char* end;
+  u64 val = strtoull(str, &end, 10);
+  *out = val;
+  return end != str && *end == '\0';
+}
+
+// Parses a size in bytes, with an optional K, M or G suffix. Returns success.
+bool parse_size(const char* str, u64* out) {
+  char* end;
+  u64 val = strtoull(str, &end, 10);
+  if (end == str) {
+    return false;
+  }
+  switch (*end) {
+    case 'k': case 'K': val <<= 10; ++end; break;
+    case 'm': case 'M': val <<= 20; ++end; break;
+    case 'g': case 'G': val <<= 30; ++end; break;
+  }
+  if (*end == 'i' || *end == 'I') ++end;
+  if (*end == 'b' || *end == 'B') ++end;
+  *out = val;
+  return *end == '\0';
+}
+
+// Parses a boolean (1/0, on/off, true/false, yes/no). Returns success.
+bool parse_bool(const char* str, bool* out) {
+  const char* yes[] = {"1", "on", "true", "yes"};
+  const char* no[]  = {"0", "off", "false", "no"};
+  for (u32 i = 0; i < 4; ++i) {
+    if (strcmp(str, yes[i]) == 0) { *out = true; return true; }
+    if (strcmp(str, no[i]) == 0) { *out = false; return true; }
+  }
+  return false;
+}
+
+// Sets a runtime option by name. Returns success.
+bool hvm_c_opt(const char* key, const char* val) {
+  if (strcmp(key, "heap") == 0) {
+    return parse_size(val, &OPTS.heap);
+  }
+  if (strcmp(key, "heap-init") == 0) {
+    return parse_size(val, &OPTS.heap_init);
+  }
+  if (strcmp(key, "hugepages") == 0) {
+    return parse_bool(val, &OPTS.hugepages);
+  }
+  if (strcmp(key, "compact") == 0) {
+    return parse_uint(val, &OPTS.compact);
+  }
+  if (strcmp(key, "threads") == 0) {
+    return parse_uint(val, &OPTS.threads) && OPTS.threads > 0;
+  }
+  if (strcmp(key, "sched") == 0) {
+    const char* scheds[] = {"fixed", "adaptive", "depth"};
+    for (u32 i = 0; i < 3; ++i) {
+      if (strcmp(val, scheds[i]) == 0) {
+        OPTS.sched = i;
+        return true;
+      }
+    }
+    return false;
+  }
+  if (strcmp(key, "sched-low") == 0) {
+    return parse_uint(val, &OPTS.sched_low) && OPTS.sched_low <= 100;
+  }
+  if (strcmp(key, "sched-high") == 0) {
+    return parse_uint(val, &OPTS.sched_high) && OPTS.sched_high <= 100;
+  }
+  if (strcmp(key, "batch") == 0) {
+    return parse_uint(val, &OPTS.batch) && OPTS.batch >= 1 && OPTS.batch <= BATCH_MAX;
+  }
+  if (strcmp(key, "stats") == 0) {
+    return parse_bool(val, &OPTS.stats);
+  }
+  if (strcmp(key, "profile") == 0) {
+    free(OPTS.profile);
+    OPTS.profile = strdup(val);
+    return OPTS.profile != NULL;
+  }
+  if (strcmp(key, "trace") == 0) {
+    free(OPTS.trace);
+    OPTS.trace = strdup(val);
+    return OPTS.trace != NULL;
+  }
+  if (strcmp(key, "report") == 0) {
+    const char* reports[] = {"text", "json"};
+    for (u32 i = 0; i < 2; ++i) {
+      if (strcmp(val, reports[i]) == 0) {
+        OPTS.report = i;
+        return true;
+      }
+    }
+    return false;
+  }
+  if (strcmp(key, "sample") == 0) {
+    return parse_uint(val, &OPTS.sample);
+  }
+  if (strcmp(key, "sample-file") == 0) {
+    free(OPTS.sample_file);
+    OPTS.sample_file = strdup(val);
+    return OPTS.sample_file != NULL;
+  }
+  if (strcmp(key, "oper-batch") == 0) {
+    return parse_uint(val, &OPTS.oper_batch) && OPTS.oper_batch <= OPER_BATCH_MAX;
+  }
+  if (strcmp(key, "pin") == 0) {
+    const char* pins[] = {"none", "compact", "cores", "scatter"};
+    for (u32 i = 0; i < 4; ++i) {
+      if (strcmp(val, pins[i]) == 0) {
+        OPTS.pin = i;
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+// Sets runtime options from command-line arguments (`--key val`, `--key=val`
+// or, for booleans, just `--key`). Returns success.
+bool hvm_c_args(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      fprintf(stderr, "unexpected argument: %s\n", argv[i]);
+      return false;
+    }
+    char  key[256];
+    char* val = strchr(argv[i], '=');
+    if (val != NULL) {
+      snprintf(key, sizeof(key), "%.*s", (int)(val - argv[i] - 2), argv[i] + 2);
+      val = val + 1;
+    } else if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+      snprintf(key, sizeof(key), "%s", argv[i] + 2);
+      val = argv[++i];
+    } else {
+      snprintf(key, sizeof(key), "%s", argv[i] + 2);
+      val = "1";
+    }
+    if (!hvm_c_opt(key, val)) {
+      fprintf(stderr, "invalid option: --%s %s\n", key, val);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Threads
+// -------
+
+// Reads the cgroup cpu quota, in cpus (rounded up). Returns 0 if unlimited.
+u32 cpu_quota() {
+  u64 quota = 0;
+  u64 period = 0;
+  char max[32];
+  FILE* file = fopen("/sys/fs/cgroup/cpu.max", "r");
+  if (file != NULL) {
+    if (fscanf(file, "%31s %" SCNu64, max, &period) == 2 && strcmp(max, "max") != 0) {
+      parse_uint(max, &quota);
+    }
+    fclose(file);
+  } else if ((file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) != NULL) {
+    i64 val = -1;
+    if (fscanf(file, "%" SCNd64, &val) == 1 && val > 0) {
+      quota = val;
+    }
+    fclose(file);
+    if ((file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) != NULL) {
+      if (fscanf(file, "%" SCNu64, &period) != 1) {
+        period = 0;
+      }
+      fclose(file);
+    }
+  }
+  return quota > 0 && period > 0 ? (quota + period - 1) / period : 0;
+}
+
+// Counts the cpus we may run on: the affinity mask, capped by the quota.
+u32 cpu_count() {
+  cpu_set_t set;
+  u32 cpus = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : get_nprocs();
+  u32 quota = cpu_quota();
+  return quota > 0 && quota < cpus ? quota : cpus;
+}
+
+// Picks the thread count: --threads, else HVM_THREADS, else the cpu count.
+// Then splits the heap into per-thread slices.
+void tpc_init() {
+  u64 num = OPTS.threads;
+  const char* env = getenv("HVM_THREADS");
+  if (num == 0 && env != NULL && !parse_uint(env, &num)) {
+    fprintf(stderr, "HVM: invalid HVM_THREADS: %s\n", env);
+    num = 0;
+  }
+  if (num == 0) {
+    #ifdef TPC_L2
+    num = 1ul << TPC_L2;
+    #else
+    num = cpu_count();
+    #endif
+  }
+  u64 max = min64(TPC_MAX, min64(G_NODE_LEN, G_VARS_LEN) / SLICE_ALIGN);
+  if (num > max) {
+    fprintf(stderr, "HVM: using %" PRIu64 " threads (the max)\n", max);
+    num = max;
+  }
+  TPC = num > 0 ? num : 1;
+  NODE_SLICE = G_NODE_LEN / TPC & ~(SLICE_ALIGN - 1);
+  VARS_SLICE = G_VARS_LEN / TPC & ~(SLICE_ALIGN - 1);
+}
+
 // Ports / Pairs / Rules
 // ---------------------
 
@@ -347,6 +930,26 @@ static inline bool is_high_priority(Rule rule) {
   return (bool)((0b00011101 >> rule) & 1);
 }
 
+// Scheduling Levels: as live nodes fill the heap budget, OPER and SWIT, then
+// COMM, are also kept local (in the mbag), and reduced before any CALL. Only
+// CALL redexes stay stealable then, and evaluation turns depth-first, giving
+// erasures and annihilations a chance to keep up with expansion.
+#define SCHED_NORMAL   0 // below the low watermark
+#define SCHED_PRESSURE 1 // between the watermarks
+#define SCHED_CRITICAL 2 // above the high watermark
+
+// Rules kept in the mbag, per level.
+static const u8 MBAG_RULES[3] = {
+  0,
+  1 << OPER | 1 << SWIT,
+  1 << OPER | 1 << SWIT | 1 << COMM,
+};
+
+// Gets whether a rule goes to the mbag, at a scheduling level.
+static inline bool is_mid_priority(Rule rule, u32 lvl) {
+  return (MBAG_RULES[lvl] >> rule) & 1;
+}
+
 // Adjusts a newly allocated port.
 static inline Port adjust_port(Net* net, TM* tm, Port port) {
   Tag tag = get_tag(port);
@@ -368,7 +971,7 @@ static inline Pair adjust_pair(Net* net, TM* tm, Pair pair) {
 
 // Constructor and getters for SYM (operation selector)
 static inline Numb new_sym(u32 val) {
-  return (val << 5) | TY_SYM;
+  return ((Numb)val << 5) | TY_SYM;
 }
 
 static inline u32 get_sym(Numb word) {
@@ -376,23 +979,38 @@ static inline u32 get_sym(Numb word) {
 }
 
 // Constructor and getters for U24 (unsigned 24-bit integer)
-static inline Numb new_u24(u32 val) {
-  return (val << 5) | TY_U24;
+static inline Numb new_u24(UNum val) {
+  return ((Numb)val << 5) | TY_U24;
 }
 
-static inline u32 get_u24(Numb word) {
+static inline UNum get_u24(Numb word) {
   return word >> 5;
 }
 
 // Constructor and getters for I24 (signed 24-bit integer)
-static inline Numb new_i24(i32 val) {
-  return ((u32)val << 5) | TY_I24;
+static inline Numb new_i24(INum val) {
+  return ((Numb)(UNum)val << 5) | TY_I24;
 }
 
-static inline i32 get_i24(Numb word) {
-  return ((i32)word) << 3 >> 8;
+static inline INum get_i24(Numb word) {
+  return ((INum)word) << 3 >> 8;
 }
 
+#ifdef HVM64
+// Constructor and getters for F24 (a full f32, with HVM64)
+static inline Numb new_f24(float val) {
+  u32 bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return ((Numb)bits << 5) | TY_F24;
+}
+
+static inline float get_f24(Numb word) {
+  u32   bits = word >> 5;
+  float val;
+  memcpy(&val, &bits, sizeof(val));
+  return val;
+}
+#else
 // Constructor and getters for F24 (24-bit float)
 static inline Numb new_f24(float val) {
   u32 bits = *(u32*)&val;
@@ -409,6 +1027,7 @@ static inline float get_f24(Numb word) {
   u32 bits = (word << 3) & 0xFFFFFF00;
   return *(float*)&bits;
 }
+#endif
 
 // Flip flag
 static inline Tag get_typ(Numb word) {
@@ -428,6 +1047,27 @@ static inline Numb partial(Numb a, Numb b) {
   return (b & ~0x1F) | get_sym(a);
 }
 
+// Books written by 32-bit builds store 32-bit ports. With HVM64, they're
+// widened on load.
+static inline Port port_load(u32 word) {
+#ifdef HVM64
+  Tag tag = word & 7;
+  u32 val = word >> 3;
+  if (tag == NUM && get_typ(val) == TY_I24) {
+    return new_port(NUM, new_i24(((i32)val) << 3 >> 8));
+  }
+  if (tag == NUM && get_typ(val) == TY_F24) {
+    u32   bits = (val << 3) & 0xFFFFFF00;
+    float num;
+    memcpy(&num, &bits, sizeof(num));
+    return new_port(NUM, new_f24(num));
+  }
+  return new_port(tag, val);
+#else
+  return word;
+#endif
+}
+
 // Cast a number to another type.
 // The semantics are meant to spiritually resemble rust's numeric casts:
 // - i24 <-> u24: is just reinterpretation of bits
@@ -440,21 +1080,24 @@ static inline Numb cast(Numb a, Numb b) {
   if (get_sym(a) == TY_U24 && get_typ(b) == TY_U24) return b;
   if (get_sym(a) == TY_U24 && get_typ(b) == TY_I24) {
     // reinterpret bits
-    i32 val = get_i24(b);
-    return new_u24(*(u32*) &val);
+    INum val = get_i24(b);
+    return new_u24(*(UNum*) &val);
   }
   if (get_sym(a) == TY_U24 && get_typ(b) == TY_F24) {
     f32 val = get_f24(b);
     if (isnan(val)) {
       return new_u24(0);
     }
-    return new_u24((u32) clamp(val, U24_MIN, U24_MAX));
+    // With HVM64, U24_MAX rounds up to 2^56 as a float, so this clamps again
+    UNum num = (UNum) clamp(val, U24_MIN, U24_MAX);
+    UNum max = ((UNum)1 << NUMB_BITS) - 1;
+    return new_u24(num > max ? max : num);
   }
 
   if (get_sym(a) == TY_I24 && get_typ(b) == TY_U24) {
     // reinterpret bits
-    u32 val = get_u24(b);
-    return new_i24(*(i32*) &val);
+    UNum val = get_u24(b);
+    return new_i24(*(INum*) &val);
   }
   if (get_sym(a) == TY_I24 && get_typ(b) == TY_I24) return b;
   if (get_sym(a) == TY_I24 && get_typ(b) == TY_F24) {
@@ -462,7 +1105,10 @@ static inline Numb cast(Numb a, Numb b) {
     if (isnan(val)) {
       return new_i24(0);
     }
-    return new_i24((i32) clamp(val, I24_MIN, I24_MAX));
+    // Likewise for I24_MAX, which rounds up to 2^55
+    INum num = (INum) clamp(val, I24_MIN, I24_MAX);
+    INum max = ((INum)1 << (NUMB_BITS - 1)) - 1;
+    return new_i24(num > max ? max : num);
   }
 
   if (get_sym(a) == TY_F24 && get_typ(b) == TY_U24) return new_f24((f32) get_u24(b));
@@ -506,8 +1152,8 @@ static inline Numb operate(Numb a, Numb b) {
   }
   switch (ty) {
     case TY_U24: {
-      u32 av = get_u24(a);
-      u32 bv = get_u24(b);
+      UNum av = get_u24(a);
+      UNum bv = get_u24(b);
       switch (op) {
         case OP_ADD: return new_u24(av + bv);
         case OP_SUB: return new_u24(av - bv);
@@ -524,16 +1170,16 @@ static inline Numb operate(Numb a, Numb b) {
         case OP_AND: return new_u24(av & bv);
         case OP_OR:  return new_u24(av | bv);
         case OP_XOR: return new_u24(av ^ bv);
-        case OP_SHL: return new_u24(av << (bv & 31));
-        case FP_SHL: return new_u24(bv << (av & 31));
-        case OP_SHR: return new_u24(av >> (bv & 31));
-        case FP_SHR: return new_u24(bv >> (av & 31));
+        case OP_SHL: return new_u24(av << (bv & (sizeof(UNum) * 8 - 1)));
+        case FP_SHL: return new_u24(bv << (av & (sizeof(UNum) * 8 - 1)));
+        case OP_SHR: return new_u24(av >> (bv & (sizeof(UNum) * 8 - 1)));
+        case FP_SHR: return new_u24(bv >> (av & (sizeof(UNum) * 8 - 1)));
         default:     return new_u24(0);
       }
     }
     case TY_I24: {
-      i32 av = get_i24(a);
-      i32 bv = get_i24(b);
+      INum av = get_i24(a);
+      INum bv = get_i24(b);
       switch (op) {
         case OP_ADD: return new_i24(av + bv);
         case OP_SUB: return new_i24(av - bv);
@@ -581,55 +1227,370 @@ static inline Numb operate(Numb a, Numb b) {
   }
 }
 
+// Batched Operations
+// The OPER redexes whose operands are both ready can be deferred and evaluated
+// together. `oper_eval` groups a batch by type and operation, then runs each
+// group through a loop with no branches in its body, which the compiler turns
+// into SIMD code (f24 rounding included). Casts, partial applications and the
+// ops that can't be vectorized (division, transcendentals) go through
+// `operate` one by one.
+
+// Group of a pair of operands, after putting the operator first. Returns
+// OPER_SCALAR if it can't be evaluated in a kernel.
+#define OPER_SCALAR 0x7F
+static inline u32 oper_key(Numb* a, Numb* b) {
+  Tag at = get_typ(*a);
+  Tag bt = get_typ(*b);
+  if (at == TY_SYM || bt == TY_SYM || (at >= OP_ADD) == (bt >= OP_ADD)) {
+    return OPER_SCALAR;
+  }
+  if (bt >= OP_ADD) {
+    Numb swp = *a; *a = *b; *b = swp;
+    Tag  tsw = at; at = bt; bt = tsw;
+  }
+  return (bt - TY_U24) << 5 | at;
+}
+
+// Applies the operation of a group to `len` operand pairs. GCC only
+// vectorizes at -O3, unless asked.
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("tree-vectorize")))
+#endif
+static void oper_kernel(u32 key, u32 len, const Numb* a, const Numb* b, Numb* c) {
+  #define OPER_U24(expr) for (u32 i = 0; i < len; ++i) { UNum av = get_u24(a[i]); UNum bv = get_u24(b[i]); c[i] = (expr); } return;
+  #define OPER_I24(expr) for (u32 i = 0; i < len; ++i) { INum av = get_i24(a[i]); INum bv = get_i24(b[i]); c[i] = (expr); } return;
+  #define OPER_F24(expr) for (u32 i = 0; i < len; ++i) { f32  av = get_f24(a[i]); f32  bv = get_f24(b[i]); c[i] = (expr); } return;
+  const u32 SH = sizeof(UNum) * 8 - 1;
+  switch (key) {
+    case (TY_U24 - TY_U24) << 5 | OP_ADD: OPER_U24(new_u24(av + bv));
+    case (TY_U24 - TY_U24) << 5 | OP_SUB: OPER_U24(new_u24(av - bv));
+    case (TY_U24 - TY_U24) << 5 | FP_SUB: OPER_U24(new_u24(bv - av));
+    case (TY_U24 - TY_U24) << 5 | OP_MUL: OPER_U24(new_u24(av * bv));
+    case (TY_U24 - TY_U24) << 5 | OP_EQ:  OPER_U24(new_u24(av == bv));
+    case (TY_U24 - TY_U24) << 5 | OP_NEQ: OPER_U24(new_u24(av != bv));
+    case (TY_U24 - TY_U24) << 5 | OP_LT:  OPER_U24(new_u24(av < bv));
+    case (TY_U24 - TY_U24) << 5 | OP_GT:  OPER_U24(new_u24(av > bv));
+    case (TY_U24 - TY_U24) << 5 | OP_AND: OPER_U24(new_u24(av & bv));
+    case (TY_U24 - TY_U24) << 5 | OP_OR:  OPER_U24(new_u24(av | bv));
+    case (TY_U24 - TY_U24) << 5 | OP_XOR: OPER_U24(new_u24(av ^ bv));
+    case (TY_U24 - TY_U24) << 5 | OP_SHL: OPER_U24(new_u24(av << (bv & SH)));
+    case (TY_U24 - TY_U24) << 5 | FP_SHL: OPER_U24(new_u24(bv << (av & SH)));
+    case (TY_U24 - TY_U24) << 5 | OP_SHR: OPER_U24(new_u24(av >> (bv & SH)));
+    case (TY_U24 - TY_U24) << 5 | FP_SHR: OPER_U24(new_u24(bv >> (av & SH)));
+    case (TY_I24 - TY_U24) << 5 | OP_ADD: OPER_I24(new_i24(av + bv));
+    case (TY_I24 - TY_U24) << 5 | OP_SUB: OPER_I24(new_i24(av - bv));
+    case (TY_I24 - TY_U24) << 5 | FP_SUB: OPER_I24(new_i24(bv - av));
+    case (TY_I24 - TY_U24) << 5 | OP_MUL: OPER_I24(new_i24(av * bv));
+    case (TY_I24 - TY_U24) << 5 | OP_EQ:  OPER_I24(new_u24(av == bv));
+    case (TY_I24 - TY_U24) << 5 | OP_NEQ: OPER_I24(new_u24(av != bv));
+    case (TY_I24 - TY_U24) << 5 | OP_LT:  OPER_I24(new_u24(av < bv));
+    case (TY_I24 - TY_U24) << 5 | OP_GT:  OPER_I24(new_u24(av > bv));
+    case (TY_I24 - TY_U24) << 5 | OP_AND: OPER_I24(new_i24(av & bv));
+    case (TY_I24 - TY_U24) << 5 | OP_OR:  OPER_I24(new_i24(av | bv));
+    case (TY_I24 - TY_U24) << 5 | OP_XOR: OPER_I24(new_i24(av ^ bv));
+    case (TY_F24 - TY_U24) << 5 | OP_ADD: OPER_F24(new_f24(av + bv));
+    case (TY_F24 - TY_U24) << 5 | OP_SUB: OPER_F24(new_f24(av - bv));
+    case (TY_F24 - TY_U24) << 5 | FP_SUB: OPER_F24(new_f24(bv - av));
+    case (TY_F24 - TY_U24) << 5 | OP_MUL: OPER_F24(new_f24(av * bv));
+    case (TY_F24 - TY_U24) << 5 | OP_DIV: OPER_F24(new_f24(av / bv));
+    case (TY_F24 - TY_U24) << 5 | FP_DIV: OPER_F24(new_f24(bv / av));
+    case (TY_F24 - TY_U24) << 5 | OP_EQ:  OPER_F24(new_u24(av == bv));
+    case (TY_F24 - TY_U24) << 5 | OP_NEQ: OPER_F24(new_u24(av != bv));
+    case (TY_F24 - TY_U24) << 5 | OP_LT:  OPER_F24(new_u24(av < bv));
+    case (TY_F24 - TY_U24) << 5 | OP_GT:  OPER_F24(new_u24(av > bv));
+  }
+  for (u32 i = 0; i < len; ++i) {
+    c[i] = operate(a[i], b[i]);
+  }
+  #undef OPER_U24
+  #undef OPER_I24
+  #undef OPER_F24
+}
+
+// Evaluates `len` operations at once: c[i] = operate(a[i], b[i]).
+static void oper_eval(u32 len, const Numb* a, const Numb* b, Numb* c) {
+  Numb xa[OPER_BATCH_MAX];
+  Numb xb[OPER_BATCH_MAX];
+  Numb xc[OPER_BATCH_MAX];
+  u8   key[OPER_BATCH_MAX];
+  u16  idx[OPER_BATCH_MAX];
+  u16  ini[OPER_SCALAR + 2] = {0};
+
+  // Sorts the operands by group (a counting sort)
+  for (u32 i = 0; i < len; ++i) {
+    xa[i] = a[i];
+    xb[i] = b[i];
+    key[i] = oper_key(&xa[i], &xb[i]);
+    ini[key[i] + 1] += 1;
+  }
+
+  // If they are all in one group, there is nothing to sort
+  if (len > 0 && ini[key[0] + 1] == len) {
+    oper_kernel(key[0], len, xa, xb, c);
+    return;
+  }
+
+  for (u32 k = 0; k <= OPER_SCALAR; ++k) {
+    ini[k + 1] += ini[k];
+  }
+  Numb ya[OPER_BATCH_MAX];
+  Numb yb[OPER_BATCH_MAX];
+  for (u32 i = 0; i < len; ++i) {
+    u32 j = ini[key[i]]++;
+    ya[j] = xa[i];
+    yb[j] = xb[i];
+    idx[j] = i;
+  }
+
+  // Runs each group through its kernel (ini[k] is now the end of group k)
+  u32 beg = 0;
+  for (u32 k = 0; k <= OPER_SCALAR && beg < len; ++k) {
+    if (ini[k] > beg) {
+      oper_kernel(k, ini[k] - beg, ya + beg, yb + beg, xc + beg);
+      beg = ini[k];
+    }
+  }
+  for (u32 j = 0; j < len; ++j) {
+    c[idx[j]] = xc[j];
+  }
+}
+
 // RBag
 // ----
 
-// FIXME: what about some bound checks?
+// Gets a slot of a deque's ring.
+static inline APair* deque_slot(Ring* ring, u64 idx) {
+  return &ring->buf[idx & (ring->len - 1)];
+}
+
+// Allocates a ring of `len` redexes. Returns NULL if out of memory.
+static Ring* ring_new(u64 len) {
+  Ring* ring = mmap(NULL, sizeof(Ring) + len * sizeof(APair), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    return NULL;
+  }
+  ring->len = len;
+  ring->old = NULL;
+  return ring;
+}
+
+// Frees a ring and the ones it replaced.
+static void ring_free(Ring* ring) {
+  while (ring != NULL) {
+    Ring* old = ring->old;
+    munmap(ring, sizeof(Ring) + ring->len * sizeof(APair));
+    ring = old;
+  }
+}
+
+// Moves a full deque to a ring twice as long. Exits if out of memory.
+static Ring* deque_grow(Deque* deq, Ring* ring, u64 top, u64 bot) {
+  Ring* neo = ring_new(ring->len * 2);
+  if (neo == NULL) {
+    fprintf(stderr, "HVM: out of memory: %" PRIu64 " redexes pending\n", bot - top);
+    exit(1);
+  }
+  for (u64 i = top; i < bot; ++i) {
+    atomic_store_explicit(deque_slot(neo, i), atomic_load_explicit(deque_slot(ring, i), memory_order_relaxed), memory_order_relaxed);
+  }
+  neo->old = ring;
+  atomic_store_explicit(&deq->ring, neo, memory_order_release);
+  return neo;
+}
+
+// Length of a thread's deque. Exact for its owner, a hint for others.
+static inline u32 deque_len(Net* net, u32 tid) {
+  u64 bot = atomic_load_explicit(&net->deqs[tid].bot, memory_order_relaxed);
+  u64 top = atomic_load_explicit(&net->deqs[tid].top, memory_order_relaxed);
+  return bot > top ? bot - top : 0;
+}
+
+// Max inboxes checked when handing off a parallel redex.
+#define GIVE_MAX 32
+
+// Hands a parallel redex to the nearest thread with an open inbox. The
+// receiver was idle, so it's counted as busy before it can see the redex.
+// Returns success.
+static inline bool give_redex(Net* net, TM* tm, Pair redex) {
+  if (atomic_load_explicit(&net->idle, memory_order_relaxed) == 0) {
+    return false;
+  }
+  u32 len = min(tm->vend[STEAL_LEVELS - 1], GIVE_MAX);
+  for (u32 i = 0; i < len; ++i) {
+    Inbox* box = &net->inbox[tm->vics_buf[i]];
+    u32 open = 1;
+    if (atomic_load_explicit(&box->open, memory_order_relaxed)
+    &&  atomic_compare_exchange_strong_explicit(&box->open, &open, 0, memory_order_acq_rel, memory_order_relaxed)) {
+      atomic_fetch_sub_explicit(&net->idle, 1, memory_order_acq_rel);
+      atomic_store_explicit(&box->redex, clr_par_flag(redex), memory_order_release);
+      tm->give += 1;
+      return true;
+    }
+  }
+  return false;
+}
 
 static inline void push_redex(Net* net, TM* tm, Pair redex) {
   #ifdef DEBUG
-  bool free_local = tm->hput < HLEN;
-  bool free_global = tm->rput < RLEN;
-  if (!free_global || !free_local) {
-    debug("push_redex: limited resources, maybe corrupting memory\n");
+  if (tm->hput + tm->mput >= HLEN) {
+    debug("push_redex: hbag full, spilling to the deque\n");
   }
   #endif
 
-  if (is_high_priority(get_pair_rule(redex))) {
+  // Full hbags spill to the deque.
+  Rule rule = get_pair_rule(redex);
+  bool room = tm->hput + tm->mput < HLEN;
+  if (room && is_high_priority(rule)) {
     tm->hbag_buf[tm->hput++] = redex;
+    tm->hmax = tm->hput + tm->mput > tm->hmax ? tm->hput + tm->mput : tm->hmax;
+  } else if (room && is_mid_priority(rule, atomic_load_explicit(&net->sched, memory_order_relaxed))) {
+    tm->hbag_buf[HLEN - ++tm->mput] = redex;
+    tm->hmax = tm->hput + tm->mput > tm->hmax ? tm->hput + tm->mput : tm->hmax;
   } else {
-    atomic_store_explicit(&net->rbag_buf[tm->tid*(G_RBAG_LEN/TPC) + (tm->rput++)], redex, memory_order_relaxed);
+    bool par = get_par_flag(redex);
+    if (par && give_redex(net, tm, redex)) {
+      return;
+    }
+    Deque* deq = &net->deqs[tm->tid];
+    u64  bot  = atomic_load_explicit(&deq->bot, memory_order_relaxed);
+    u64  top  = atomic_load_explicit(&deq->top, memory_order_relaxed);
+    Ring* ring = atomic_load_explicit(&deq->ring, memory_order_relaxed);
+    if (bot - top >= ring->len) {
+      ring = deque_grow(deq, ring, top, bot);
+    }
+    atomic_store_explicit(deque_slot(ring, bot), redex, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deq->bot, bot + 1, memory_order_relaxed);
+    u32 rlen = bot + 1 - top + tm->hput + tm->mput;
+    tm->rmax = rlen > tm->rmax ? rlen : tm->rmax;
+    // Wakes a sleeping thread once we have a redex to spare (on every
+    // parallel redex, else only on the first)
+    if (atomic_load_explicit(&net->sleep, memory_order_relaxed) > 0
+    &&  (par ? top < bot : top + 1 == bot)) {
+      atomic_fetch_add_explicit(&net->park, 1, memory_order_release);
+      futex_wake(&net->park, 1);
+    }
   }
 }
 
 static inline Pair pop_redex(Net* net, TM* tm) {
   if (tm->hput > 0) {
     return tm->hbag_buf[--tm->hput];
-  } else if (tm->rput > 0) {
-    return atomic_exchange_explicit(&net->rbag_buf[tm->tid*(G_RBAG_LEN/TPC) + (--tm->rput)], 0, memory_order_relaxed);
-  } else {
+  }
+  if (tm->mput > 0) {
+    return tm->hbag_buf[HLEN - tm->mput--];
+  }
+  Deque* deq = &net->deqs[tm->tid];
+  u64 bot = atomic_load_explicit(&deq->bot, memory_order_relaxed);
+  if (atomic_load_explicit(&deq->top, memory_order_relaxed) >= bot) {
+    return 0;
+  }
+  bot -= 1;
+  atomic_store_explicit(&deq->bot, bot, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  u64 top = atomic_load_explicit(&deq->top, memory_order_relaxed);
+  Pair got = 0;
+  if (top <= bot) {
+    Ring* ring = atomic_load_explicit(&deq->ring, memory_order_relaxed);
+    got = atomic_load_explicit(deque_slot(ring, bot), memory_order_relaxed);
+    if (top < bot) {
+      return got;
+    }
+    // Last redex: races with thieves for it
+    if (!atomic_compare_exchange_strong_explicit(&deq->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+      got = 0;
+    }
+  }
+  atomic_store_explicit(&deq->bot, bot + 1, memory_order_relaxed);
+  return got;
+}
+
+// Takes the oldest redex of another thread's deque. Returns 0 if there was
+// none, or another thread took it first.
+static inline Pair take_redex(Net* net, u32 tid) {
+  Deque* deq = &net->deqs[tid];
+  u64 top = atomic_load_explicit(&deq->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  u64 bot = atomic_load_explicit(&deq->bot, memory_order_acquire);
+  if (top >= bot) {
+    return 0;
+  }
+  Ring* ring = atomic_load_explicit(&deq->ring, memory_order_acquire);
+  Pair got = atomic_load_explicit(deque_slot(ring, top), memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&deq->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
     return 0;
   }
+  return got;
 }
 
 static inline u32 rbag_len(Net* net, TM* tm) {
-  return tm->rput + tm->hput;
+  return deque_len(net, tm->tid) + tm->hput + tm->mput;
+}
+
+// Book
+// ----
+
+// Gets a def by its id.
+static inline Def* book_def(Book* book, u32 fid) {
+  return (Def*)(book->defs_buf + book->defs_off[fid]);
+}
+
+// Gets a def's redexes.
+static inline Pair* def_rbag_buf(Def* def) {
+  return def->data;
+}
+
+// Gets a def's nodes.
+static inline Pair* def_node_buf(Def* def) {
+  return def->data + def->rbag_len;
+}
+
+// Size of a def, in bytes.
+static inline u64 def_size(u32 rbag_len, u32 node_len) {
+  return sizeof(Def) + (u64)(rbag_len + node_len) * sizeof(Pair);
 }
 
 // TM
 // --
 
-static TM* tm[TPC];
+static TM* tm[TPC_MAX];
 
 TM* tm_new(u32 tid) {
   TM* tm   = malloc(sizeof(TM));
   tm->tid  = tid;
+  tm->nloc = malloc(LOC_LEN * sizeof(Loc));
+  tm->vloc = malloc(LOC_LEN * sizeof(Loc));
   tm->itrs = 0;
-  tm->nput = 1;
-  tm->vput = 1;
-  tm->rput = 0;
+  tm->nput = 0;
+  tm->vput = 0;
+  tm->nswp = 0;
+  tm->vswp = 0;
+  tm->nlim = 0;
+  tm->vlim = 0;
   tm->hput = 0;
-  tm->sidx = 0;
+  tm->mput = 0;
+  tm->nliv = 0;
+  tm->seed = tid * 0x9E3779B9 + 1;
+  // Until topo_init runs, all other threads count as on the same node.
+  for (u32 l = 0; l < STEAL_LEVELS; ++l) {
+    tm->vend[l] = l < STEAL_NODE ? 0 : TPC - 1;
+    tm->stls[l] = 0;
+  }
+  for (u32 t = 0; t + 1 < TPC; ++t) {
+    tm->vics_buf[t] = t + (t >= tid);
+  }
+  tm->give = 0;
+  tm->open = false;
+  tm->nfre = 0;
+  tm->vfre = 0;
+  tm->olen = 0;
+  memset(&tm->stat, 0, sizeof(Stats));
+  tm->prof = NULL;
+  tm->trace = NULL;
+  tm->nmax = 0;
+  tm->vmax = 0;
+  tm->hmax = 0;
+  tm->rmax = 0;
   return tm;
 }
 
@@ -641,68 +1602,589 @@ void alloc_static_tms() {
 
 void free_static_tms() {
   for (u32 t = 0; t < TPC; ++t) {
+    free(tm[t]->nloc);
+    free(tm[t]->vloc);
+    if (tm[t]->prof) {
+      free(tm[t]->prof->defs);
+      free(tm[t]->prof);
+    }
+    free(tm[t]->trace);
     free(tm[t]);
   }
 }
 
-// Net
-// ----
-
-// Stores a new node on global.
-static inline void node_create(Net* net, u32 loc, Pair val) {
-  atomic_store_explicit(&net->node_buf[loc], val, memory_order_relaxed);
-}
-
-// Stores a var on global.
-static inline void vars_create(Net* net, u32 var, Port val) {
-  atomic_store_explicit(&net->vars_buf[var], val, memory_order_relaxed);
-}
-
-// Reads a node from global.
-static inline Pair node_load(Net* net, u32 loc) {
-  return atomic_load_explicit(&net->node_buf[loc], memory_order_relaxed);
-}
+// Profiler
+// --------
 
-// Reads a var from global.
-static inline Port vars_load(Net* net, u32 var) {
-  return atomic_load_explicit(&net->vars_buf[var], memory_order_relaxed);
+// Gives each TM an empty call profile. Returns success.
+bool prof_init(Book* book) {
+  for (u32 t = 0; t < TPC; ++t) {
+    Prof* p = calloc(1, sizeof(Prof));
+    if (p == NULL || (p->defs = calloc(book->defs_len, sizeof(u64))) == NULL) {
+      free(p);
+      return false;
+    }
+    p->len    = 1;
+    p->fid[0] = PROF_ROOT;
+    tm[t]->prof = p;
+  }
+  return true;
 }
 
-// Stores a node on global.
-static inline void node_store(Net* net, u32 loc, Pair val) {
-  atomic_store_explicit(&net->node_buf[loc], val, memory_order_relaxed);
+// Returns the child of node `up` for def `fid`, adding it if new. When the
+// tree is full, returns `up` itself.
+static u32 prof_child(Prof* p, u32 up, u32 fid) {
+  for (u32 k = p->kid[up]; k != 0; k = p->sib[k]) {
+    if (p->fid[k] == fid) {
+      return k;
+    }
+  }
+  if (p->len == PROF_LEN) {
+    return up;
+  }
+  u32 k = p->len++;
+  p->fid[k] = fid;
+  p->up[k]  = up;
+  p->sib[k] = p->kid[up];
+  p->kid[up] = k;
+  return k;
 }
 
-// Exchanges a node on global by a value. Returns old.
-static inline Pair node_exchange(Net* net, u32 loc, Pair val) {
-  return atomic_exchange_explicit(&net->node_buf[loc], val, memory_order_relaxed);
+// Charges the interactions since the last call to the current node.
+static inline void prof_flush(TM* tm) {
+  Prof* p = tm->prof;
+  p->itrs[p->ctx] += tm->itrs - p->mark;
+  p->mark = tm->itrs;
 }
 
-// Exchanges a var on global by a value. Returns old.
-static inline Port vars_exchange(Net* net, u32 var, Port val) {
-  return atomic_exchange_explicit(&net->vars_buf[var], val, memory_order_relaxed);
+// Records a call to def `fid`, making it the current node.
+static inline void prof_call(TM* tm, u32 fid) {
+  Prof* p = tm->prof;
+  prof_flush(tm);
+  u32 x = p->ctx;
+  while (x != 0 && p->fid[x] != fid) {
+    x = p->up[x];
+  }
+  p->ctx = x != 0 ? x : prof_child(p, p->ctx, fid);
+  p->calls[p->ctx] += 1;
+  p->defs[fid] += 1;
 }
 
-// Takes a node.
-static inline Pair node_take(Net* net, u32 loc) {
-  return node_exchange(net, loc, 0);
-}
+// Merges the threads' profiles. Prints a per-def report, sorted by the
+// interactions that descended from each def, and writes the call tree to
+// `OPTS.profile` as folded stacks (one `main;f;g itrs` line per path), as
+// read by flame graph tools. Returns success.
+bool prof_report(Book* book) {
+  Prof* m    = calloc(1, sizeof(Prof));
+  u32*  map  = malloc(PROF_LEN * sizeof(u32));
+  u64*  calls = calloc(book->defs_len, sizeof(u64));
+  u64*  self = calloc(book->defs_len, sizeof(u64));
+  u64*  desc = calloc(book->defs_len, sizeof(u64));
+  u64*  tot  = calloc(PROF_LEN, sizeof(u64));
+  u32*  ord  = malloc(book->defs_len * sizeof(u32));
+  u32*  path = malloc(PROF_LEN * sizeof(u32));
+  bool  ok   = m && map && calls && self && desc && tot && ord && path;
+
+  // Merges the trees, parents before children
+  if (ok) {
+    m->len    = 1;
+    m->fid[0] = PROF_ROOT;
+    for (u32 t = 0; t < TPC; ++t) {
+      Prof* p = tm[t]->prof;
+      map[0] = 0;
+      m->itrs[0] += p->itrs[0];
+      for (u32 k = 1; k < p->len; ++k) {
+        map[k] = prof_child(m, map[p->up[k]], p->fid[k]);
+        m->calls[map[k]] += p->calls[k];
+        m->itrs[map[k]]  += p->itrs[k];
+      }
+      for (u32 f = 0; f < book->defs_len; ++f) {
+        calls[f] += p->defs[f];
+      }
+    }
 
-// Takes a var.
-static inline Port vars_take(Net* net, u32 var) {
-  return vars_exchange(net, var, 0);
-}
+    // Sums up each subtree. A def never sits below itself, so its subtrees
+    // don't overlap.
+    for (u32 k = m->len; k-- > 0;) {
+      tot[k] += m->itrs[k];
+      if (k > 0) {
+        tot[m->up[k]] += tot[k];
+        self[m->fid[k]] += m->itrs[k];
+        desc[m->fid[k]] += tot[k];
+      }
+    }
+  }
 
+  // Prints the report
+  if (ok) {
+    u32 len = 0;
+    for (u32 f = 0; f < book->defs_len; ++f) {
+      if (calls[f] > 0) {
+        u32 i = len++;
+        for (; i > 0 && desc[ord[i - 1]] < desc[f]; --i) {
+          ord[i] = ord[i - 1];
+        }
+        ord[i] = f;
+      }
+    }
+    printf("- PROFILE: %" PRIu32 " defs called, %" PRIu32 " call paths%s\n", len, m->len - 1, m->len == PROF_LEN ? " (truncated)" : "");
+    printf("  %12s %12s %12s %12s %12s %12s  %s\n", "calls", "nodes", "vars", "redexes", "self", "descended", "def");
+    for (u32 i = 0; i < len; ++i) {
+      u32  f   = ord[i];
+      Def* def = book_def(book, f);
+      printf("  %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "  %s\n",
+        calls[f], calls[f] * def->node_len, calls[f] * def->vars_len, calls[f] * def->rbag_len,
+        self[f], desc[f], &book->name_buf[def->name]);
+    }
+  }
 
-// Net
+  // Writes the folded stacks
+  FILE* file = ok ? fopen(OPTS.profile, "w") : NULL;
+  if (file != NULL) {
+    for (u32 k = 0; k < m->len; ++k) {
+      if (m->itrs[k] == 0) {
+        continue;
+      }
+      u32 len = 0;
+      for (u32 x = k; x != 0; x = m->up[x]) {
+        path[len++] = m->fid[x];
+      }
+      if (len == 0) {
+        fprintf(file, "(boot)");
+      }
+      while (len-- > 0) {
+        fprintf(file, "%s%s", &book->name_buf[book_def(book, path[len])->name], len > 0 ? ";" : "");
+      }
+      fprintf(file, " %" PRIu64 "\n", m->itrs[k]);
+    }
+    ok = fclose(file) == 0;
+  } else {
+    ok = false;
+  }
+
+  free(m);
+  free(map);
+  free(calls);
+  free(self);
+  free(desc);
+  free(tot);
+  free(ord);
+  free(path);
+  return ok;
+}
+
+// Tracer
+// ------
+
+static Trace* TRACE_MAIN = NULL; // the main thread's timeline
+static u64    TRACE_INI  = 0; // time tracing started
+
+// Gives each TM, and the main thread, an empty timeline. Returns success.
+bool trace_init() {
+  TRACE_INI  = time64();
+  TRACE_MAIN = malloc(sizeof(Trace));
+  if (TRACE_MAIN == NULL) {
+    return false;
+  }
+  TRACE_MAIN->len = 0;
+  for (u32 t = 0; t < TPC; ++t) {
+    tm[t]->trace = malloc(sizeof(Trace));
+    if (tm[t]->trace == NULL) {
+      return false;
+    }
+    tm[t]->trace->len = 0;
+  }
+  return true;
+}
+
+// Returns the time a span starts, if tracing.
+static inline u64 trace_now(Trace* tr) {
+  return tr ? time64() : 0;
+}
+
+// Records a span from `ini` to now, if tracing.
+static inline void trace_span(Trace* tr, u32 kind, u64 ini, u32 arg) {
+  if (tr) {
+    Span* sp = &tr->buf[tr->len++ % TRACE_LEN];
+    sp->ini  = ini;
+    sp->end  = time64();
+    sp->kind = kind;
+    sp->arg  = arg;
+  }
+}
+
+// Writes a timeline's spans as Chrome trace events, for thread `tid`.
+static void trace_write_spans(FILE* file, Book* book, Trace* tr, u32 tid, bool* first) {
+  const char* names[] = {"busy", "idle", "sync", "normalize", "io"};
+  u64 ini = tr->len > TRACE_LEN ? tr->len - TRACE_LEN : 0;
+  for (u64 i = ini; i < tr->len; ++i) {
+    Span* sp = &tr->buf[i % TRACE_LEN];
+    const char* name = names[sp->kind];
+    if (sp->kind == TRACE_IO && book && sp->arg < book->ffns_len) {
+      name = book->ffns_buf[sp->arg].name;
+    }
+    fprintf(file, "%s\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %" PRIu32 "}",
+      *first ? "" : ",", name, names[sp->kind], (sp->ini - TRACE_INI) / 1e3, (sp->end - sp->ini) / 1e3, tid);
+    *first = false;
+  }
+}
+
+// Writes the timelines to `OPTS.trace` in the Chrome trace format (as read
+// by chrome://tracing and Perfetto). The main thread is tid 0, and thread t
+// is tid t + 1. Returns success.
+bool trace_write(Book* book) {
+  FILE* file = fopen(OPTS.trace, "w");
+  if (file == NULL) {
+    return false;
+  }
+  fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  bool first = true;
+  for (u32 t = 0; t <= TPC; ++t) {
+    fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %" PRIu32 ", \"args\": {\"name\": \"", first ? "" : ",", t);
+    fprintf(file, t == 0 ? "main\"}}" : "thread %" PRIu32 "\"}}", t - 1);
+    first = false;
+  }
+  u64 lost = 0;
+  for (u32 t = 0; t <= TPC; ++t) {
+    Trace* tr = t == 0 ? TRACE_MAIN : tm[t - 1]->trace;
+    trace_write_spans(file, book, tr, t, &first);
+    lost += tr->len > TRACE_LEN ? tr->len - TRACE_LEN : 0;
+  }
+  fprintf(file, "\n]}\n");
+  if (lost > 0) {
+    fprintf(stderr, "HVM: trace: %" PRIu64 " early spans were overwritten\n", lost);
+  }
+  return fclose(file) == 0;
+}
+
+// Frees the main thread's timeline (the TMs' go with them).
+void trace_free() {
+  free(TRACE_MAIN);
+  TRACE_MAIN = NULL;
+}
+
+// Net
+// ----
+
+// Stores a new node on global.
+static inline void node_create(Net* net, Loc loc, Pair val) {
+#ifdef HVM64
+  atomic_store_explicit(&net->node_buf[loc].fst, get_fst(val), memory_order_relaxed);
+  atomic_store_explicit(&net->node_buf[loc].snd, get_snd(val), memory_order_relaxed);
+#else
+  atomic_store_explicit(&net->node_buf[loc], val, memory_order_relaxed);
+#endif
+}
+
+// Stores a var on global.
+static inline void vars_create(Net* net, Loc var, Port val) {
+  atomic_store_explicit(&net->vars_buf[var], val, memory_order_relaxed);
+}
+
+// Reads a node from global.
+static inline Pair node_load(Net* net, Loc loc) {
+#ifdef HVM64
+  Port fst = atomic_load_explicit(&net->node_buf[loc].fst, memory_order_relaxed);
+  Port snd = atomic_load_explicit(&net->node_buf[loc].snd, memory_order_relaxed);
+  return new_pair(fst, snd);
+#else
+  return atomic_load_explicit(&net->node_buf[loc], memory_order_relaxed);
+#endif
+}
+
+// Reads a var from global.
+static inline Port vars_load(Net* net, Loc var) {
+  return atomic_load_explicit(&net->vars_buf[var], memory_order_relaxed);
+}
+
+// Stores a node on global.
+static inline void node_store(Net* net, Loc loc, Pair val) {
+  node_create(net, loc, val);
+}
+
+// Exchanges a node on global by a value. Returns old.
+static inline Pair node_exchange(Net* net, Loc loc, Pair val) {
+#ifdef HVM64
+  Port fst = atomic_exchange_explicit(&net->node_buf[loc].fst, get_fst(val), memory_order_relaxed);
+  Port snd = atomic_exchange_explicit(&net->node_buf[loc].snd, get_snd(val), memory_order_relaxed);
+  return new_pair(fst, snd);
+#else
+  return atomic_exchange_explicit(&net->node_buf[loc], val, memory_order_relaxed);
+#endif
+}
+
+// Exchanges a var on global by a value. Returns old.
+static inline Port vars_exchange(Net* net, Loc var, Port val) {
+  return atomic_exchange_explicit(&net->vars_buf[var], val, memory_order_relaxed);
+}
+
+// Recycles a node location, if it is on this thread's slice.
+static inline void node_free(TM* tm, Loc loc) {
+  if (loc - tm->tid*NODE_SLICE < NODE_SLICE && tm->nfre < FREE_LEN) {
+    tm->nfre_buf[tm->nfre++] = loc;
+  }
+}
+
+// Recycles a vars location, if it is on this thread's slice.
+static inline void vars_free(TM* tm, Loc var) {
+  if (var - tm->tid*VARS_SLICE < VARS_SLICE && tm->vfre < FREE_LEN && var != get_val(ROOT)) {
+    tm->vfre_buf[tm->vfre++] = var;
+  }
+}
+
+// Max nodes a thread allocates (or takes) before publishing its count.
+#define SCHED_SYNC 4096
+
+// Publishes a thread's count of live nodes, and updates the scheduling level
+// from their share of the heap budget (with a var each).
+static void sched_update(Net* net, TM* tm) {
+  i64 live = (i64)atomic_fetch_add_explicit(&net->nodes, (i64)tm->nliv, memory_order_relaxed) + tm->nliv;
+  tm->nliv = 0;
+  atomic_max(&net->peak, live > 0 ? live : 0);
+  if (OPTS.sched == SCHED_ADAPTIVE) {
+    u64 cap = net->heap_max / (sizeof(ANode) + sizeof(APort));
+    u64 occ = live > 0 && cap > 0 ? (u64)live * 100 / cap : 0;
+    u32 lvl = occ >= OPTS.sched_high ? SCHED_CRITICAL : occ >= OPTS.sched_low ? SCHED_PRESSURE : SCHED_NORMAL;
+    if (atomic_load_explicit(&net->sched, memory_order_relaxed) != lvl) {
+      atomic_store_explicit(&net->sched, lvl, memory_order_relaxed);
+    }
+  }
+}
+
+// Counts nodes allocated (positive) or taken (negative).
+static inline void node_count(Net* net, TM* tm, i32 num) {
+  tm->nliv += num;
+  if (tm->nliv >= SCHED_SYNC || tm->nliv <= -SCHED_SYNC) {
+    sched_update(net, tm);
+  }
+}
+
+// Takes a node, recycling its location.
+static inline Pair node_take(Net* net, TM* tm, Loc loc) {
+  Pair got = node_exchange(net, loc, 0);
+  if (got != 0) {
+    node_free(tm, loc);
+    node_count(net, tm, -1);
+  }
+  return got;
+}
+
+// Frees an allocated node that went unused.
+static inline void node_drop(Net* net, TM* tm, Loc loc) {
+  node_free(tm, loc);
+  node_count(net, tm, -1);
+}
+
+// Takes a var, recycling its location.
+static inline Port vars_take(Net* net, TM* tm, Loc var) {
+  Port got = vars_exchange(net, var, 0);
+  if (got != 0) {
+    vars_free(tm, var);
+  }
+  return got;
+}
+
+
+// Net
 // ---
 
+// Gets the memory available to this process: the physical memory, capped by
+// its cgroup's limit (v2 or v1), if any.
+u64 mem_avail() {
+  struct sysinfo info;
+  sysinfo(&info);
+  u64 mem = (u64)info.totalram * info.mem_unit;
+  char path[512] = "/sys/fs/cgroup/memory.max";
+  FILE* file = fopen("/proc/self/cgroup", "r");
+  if (file != NULL) {
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+      if (strncmp(line, "0::", 3) == 0) {
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.max", line + 3);
+      }
+    }
+    fclose(file);
+  }
+  const char* paths[] = {path, "/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"};
+  for (u32 i = 0; i < 3; ++i) {
+    u64 lim;
+    file = fopen(paths[i], "r");
+    if (file == NULL) {
+      continue;
+    }
+    if (fscanf(file, "%" SCNu64, &lim) == 1 && lim > 0 && lim < mem) {
+      mem = lim;
+    }
+    fclose(file);
+  }
+  return mem;
+}
+
+// Gets the free hugetlbfs pool, in bytes.
+static u64 huge_pool() {
+  u64 free = 0;
+  u64 size = 0;
+  FILE* file = fopen("/proc/meminfo", "r");
+  if (file == NULL) {
+    return 0;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    sscanf(line, "HugePages_Free: %" SCNu64, &free);
+    sscanf(line, "Hugepagesize: %" SCNu64, &size);
+  }
+  fclose(file);
+  return free * size * 1024;
+}
+
+// True if transparent huge pages can be requested with madvise.
+static bool huge_thp() {
+  char buf[128] = {0};
+  FILE* file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+  if (file == NULL) {
+    return false;
+  }
+  bool ok = fgets(buf, sizeof(buf), file) != NULL && strstr(buf, "[never]") == NULL;
+  fclose(file);
+  return ok;
+}
+
+// Reserves address space, without committing memory. With HUGE_TLB, it is
+// mapped from the hugetlbfs pool; with HUGE_THP, it is aligned and advised
+// for transparent huge pages.
+static void* heap_reserve(u64 size, int prot, u8 huge) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+  if (huge == HUGE_TLB) {
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+  }
+  u64 pad = huge == HUGE_THP ? HUGE_ALIGN : 0;
+  u8* ptr = mmap(NULL, size + pad, prot, flags, -1, 0);
+  if (ptr == MAP_FAILED) {
+    return NULL;
+  }
+  if (huge == HUGE_THP) {
+    u8* beg = (u8*)(((uintptr_t)ptr + HUGE_ALIGN - 1) & ~(HUGE_ALIGN - 1));
+    if (beg > ptr) munmap(ptr, beg - ptr);
+    if (beg < ptr + pad) munmap(beg + size, ptr + pad - beg);
+    madvise(beg, size, MADV_HUGEPAGE);
+    ptr = beg;
+  }
+  return ptr;
+}
+
+// Commits up to `len` elements of `size` bytes at `end`, within the heap
+// budget, halving the request while it doesn't fit. Returns how many were.
+static u64 heap_grow(Net* net, void* end, u64 size, u64 len) {
+  for (; len >= HEAP_CHUNK; len /= 2) {
+    u64 bytes = len * size;
+    u64 heap = atomic_fetch_add(&net->heap_len, bytes) + bytes;
+    if (heap <= net->heap_max
+      && (net->huge == HUGE_TLB || mprotect(end, bytes, PROT_READ | PROT_WRITE) == 0)) {
+      atomic_max(&net->heap_peak, heap);
+      return len;
+    }
+    atomic_fetch_sub(&net->heap_len, bytes);
+  }
+  return 0;
+}
+
+// Reports an exhausted heap, and exits.
+static void heap_oom(Net* net) {
+  fprintf(stderr, "HVM: out of memory: %" PRIu64 " of %" PRIu64 " MiB of heap in use (see --heap)\n",
+    atomic_load(&net->heap_len) >> 20, net->heap_max >> 20);
+  exit(1);
+}
+
+// Unmaps the net's buffers.
+static void net_unmap(Net* net) {
+  if (net->node_buf) munmap(net->node_buf, G_NODE_LEN * sizeof(ANode));
+  if (net->vars_buf) munmap(net->vars_buf, G_VARS_LEN * sizeof(APort));
+  net->node_buf = NULL;
+  net->vars_buf = NULL;
+  for (u32 t = 0; t < TPC_MAX; ++t) {
+    ring_free(atomic_load(&net->deqs[t].ring));
+    atomic_store(&net->deqs[t].ring, NULL);
+  }
+}
+
+// Frees a net.
+void net_free(Net* net) {
+  if (net != NULL) {
+    net_unmap(net);
+    free(net);
+  }
+}
+
+// Reserves the net's buffers with its page backing, and allocates the
+// deques. Returns success.
+static bool net_reserve(Net* net) {
+  net->node_buf = heap_reserve(G_NODE_LEN * sizeof(ANode), PROT_NONE, net->huge);
+  net->vars_buf = heap_reserve(G_VARS_LEN * sizeof(APort), PROT_NONE, net->huge);
+  bool ok = net->node_buf && net->vars_buf;
+  for (u32 t = 0; t < TPC && ok; ++t) {
+    atomic_store(&net->deqs[t].ring, ring_new(RLEN));
+    ok = atomic_load(&net->deqs[t].ring) != NULL;
+  }
+  if (!ok) {
+    net_unmap(net);
+    return false;
+  }
+  return true;
+}
+
 // Initializes a net.
 static inline Net* net_new() {
   Net* net = calloc(1, sizeof(Net));
+  if (net == NULL) {
+    return NULL;
+  }
+
+  net->heap_max = OPTS.heap ? OPTS.heap : mem_avail();
+
+  // Picks the page backing: hugetlbfs pages if the pool has any, else
+  // transparent huge pages. Pool pages are only taken when touched, so the
+  // heap budget is capped to the pool, minus some room for rbags.
+  u64 pool = OPTS.hugepages ? huge_pool() : 0;
+  net->huge = pool > 0 ? HUGE_TLB : OPTS.hugepages && huge_thp() ? HUGE_THP : HUGE_NONE;
+  if (net->huge == HUGE_TLB && net_reserve(net)) {
+    net->heap_max = min64(net->heap_max, pool - pool / 8);
+  } else {
+    net->huge = net->huge != HUGE_NONE && huge_thp() ? HUGE_THP : HUGE_NONE;
+    if (!net_reserve(net)) {
+      fprintf(stderr, "HVM: failed to reserve the heap\n");
+      free(net);
+      return NULL;
+    }
+  }
+  if (OPTS.hugepages) {
+    const char* backing[] = {"unavailable (regular pages)", "transparent (madvise)", "hugetlbfs"};
+    fprintf(stderr, "HVM: huge pages: %s\n", backing[net->huge]);
+  }
 
+  // The root var lives at the end of vars_buf.
+  if (net->huge != HUGE_TLB) {
+    mprotect(&net->vars_buf[G_VARS_LEN - HEAP_CHUNK], HEAP_CHUNK * sizeof(APort), PROT_READ | PROT_WRITE);
+  }
+
+  atomic_store(&net->heap_len, 0);
   atomic_store(&net->itrs, 0);
+  for (u32 l = 0; l < STEAL_LEVELS; ++l) {
+    atomic_store(&net->stls[l], 0);
+  }
+  atomic_store(&net->give, 0);
+  atomic_store(&net->peak, 0);
+  atomic_store(&net->heap_peak, 0);
+  net->io_time = 0;
+  memset(&net->stat, 0, sizeof(Stats));
+  memset(net->tstat, 0, sizeof(net->tstat));
+  atomic_store(&net->nodes, 0);
+  atomic_store(&net->sched, OPTS.sched == SCHED_DEPTH ? SCHED_CRITICAL : SCHED_NORMAL);
   atomic_store(&net->idle, 0);
+  atomic_store(&net->done, 0);
+  atomic_store(&net->park, 0);
+  atomic_store(&net->sleep, 0);
 
   return net;
 }
@@ -710,71 +2192,209 @@ static inline Net* net_new() {
 // Allocator
 // ---------
 
-u32 node_alloc_1(Net* net, TM* tm, u32* lps) {
+// Each thread owns a slice of the node and vars buffers. Locations released
+// by `node_take` / `vars_take` go to a thread-local free stack, so allocating
+// is usually a pop. When the stack runs short, it is refilled in bulk: first
+// with never-used locations, in order; once the committed part of the slice
+// has been handed out, by sweeping it for empty locations. A sweep rebuilds
+// the stack from scratch, and only happens before any location of the
+// current request is popped, so no location is ever handed out twice. If a
+// sweep finds the slice crowded, more of it is committed instead. Requests
+// larger than the stack are served in chunks, holding each chunk's locations
+// before the next refill.
+
+// Initial length of a thread's slice. With huge pages, it spans at least one.
+static u64 heap_init_len(Net* net) {
+  u64 min = net->huge ? HUGE_ALIGN / sizeof(APort) : HEAP_CHUNK;
+  u64 len = OPTS.heap_init / TPC / (sizeof(ANode) + sizeof(APort));
+  len = len < min ? min : len & ~(HEAP_CHUNK - 1);
+  return len < NODE_SLICE ? len : NODE_SLICE;
+}
+
+// Commits more of this thread's node slice, doubling it. Returns success.
+static bool node_grow(Net* net, TM* tm) {
+  u64 len = tm->nlim == 0 ? heap_init_len(net) : min64(tm->nlim, NODE_SLICE - tm->nlim);
+  u64 got = heap_grow(net, &net->node_buf[tm->tid*NODE_SLICE + tm->nlim], sizeof(ANode), len);
+  tm->nlim += got;
+  return got > 0;
+}
+
+// Commits more of this thread's vars slice, doubling it. Returns success.
+static bool vars_grow(Net* net, TM* tm) {
+  u64 len = tm->vlim == 0 ? heap_init_len(net) : min64(tm->vlim, VARS_SLICE - tm->vlim);
+  u64 got = heap_grow(net, &net->vars_buf[tm->tid*VARS_SLICE + tm->vlim], sizeof(APort), len);
+  tm->vlim += got;
+  return got > 0;
+}
+
+// Refills the node free stack with at least `num` locations.
+static void node_refill(Net* net, TM* tm, u32 num) {
+  PROBE2(node_refill, tm->tid, num);
+  Loc base = tm->tid*NODE_SLICE;
+  u32 bulk = num > FREE_BULK ? num : FREE_BULK;
   while (true) {
-    u32 lc = tm->tid*(G_NODE_LEN/TPC) + (tm->nput%(G_NODE_LEN/TPC));
-    Pair elem = net->node_buf[lc];
-    tm->nput += 1;
-    if (lc > 0 && elem == 0) {
-      return lc;
+    // Takes never-used locations.
+    Loc ini = tm->nput;
+    while (tm->nput < tm->nlim && tm->nfre < bulk) {
+      Loc lc = base + tm->nput++;
+      if (lc > 0 && node_load(net, lc) == 0) {
+        tm->nfre_buf[tm->nfre++] = lc;
+      }
     }
-    // FIXME: check this decently
-    if (++(*lps) >= G_NODE_LEN/TPC) printf("OOM\n");
+    tm->stat.probe += tm->nput - ini;
+    if (tm->nfre >= num) {
+      return;
+    }
+    // Sweeps the slice for empty locations.
+    Loc lps = 0;
+    tm->nfre = 0;
+    for (; lps < tm->nlim && tm->nfre < bulk; ++lps) {
+      Loc lc = base + tm->nswp;
+      tm->nswp = (tm->nswp + 1) % tm->nlim;
+      if (lc > 0 && node_load(net, lc) == 0) {
+        tm->nfre_buf[tm->nfre++] = lc;
+      }
+    }
+    tm->stat.probe += lps;
+    // If the slice is crowded (or too small for the request), grows it.
+    if ((tm->nfre * 8 <= lps || tm->nfre < num) && node_grow(net, tm)) {
+      continue;
+    }
+    if (tm->nfre < num) {
+      heap_oom(net);
+    }
+    return;
   }
 }
 
-u32 vars_alloc_1(Net* net, TM* tm, u32* lps) {
+// Refills the vars free stack with at least `num` locations.
+static void vars_refill(Net* net, TM* tm, u32 num) {
+  PROBE2(vars_refill, tm->tid, num);
+  Loc base = tm->tid*VARS_SLICE;
+  u32 bulk = num > FREE_BULK ? num : FREE_BULK;
   while (true) {
-    u32 lc = tm->tid*(G_NODE_LEN/TPC) + (tm->vput%(G_NODE_LEN/TPC));
-    Port elem = net->vars_buf[lc];
-    tm->vput += 1;
-    if (lc > 0 && elem == 0) {
-      return lc;
+    // Takes never-used locations.
+    Loc ini = tm->vput;
+    while (tm->vput < tm->vlim && tm->vfre < bulk) {
+      Loc lc = base + tm->vput++;
+      if (lc > 0 && lc != get_val(ROOT) && vars_load(net, lc) == 0) {
+        tm->vfre_buf[tm->vfre++] = lc;
+      }
+    }
+    tm->stat.probe += tm->vput - ini;
+    if (tm->vfre >= num) {
+      return;
+    }
+    // Sweeps the slice for empty locations.
+    Loc lps = 0;
+    tm->vfre = 0;
+    for (; lps < tm->vlim && tm->vfre < bulk; ++lps) {
+      Loc lc = base + tm->vswp;
+      tm->vswp = (tm->vswp + 1) % tm->vlim;
+      if (lc > 0 && lc != get_val(ROOT) && vars_load(net, lc) == 0) {
+        tm->vfre_buf[tm->vfre++] = lc;
+      }
+    }
+    tm->stat.probe += lps;
+    // If the slice is crowded (or too small for the request), grows it.
+    if ((tm->vfre * 8 <= lps || tm->vfre < num) && vars_grow(net, tm)) {
+      continue;
+    }
+    if (tm->vfre < num) {
+      heap_oom(net);
     }
-    // FIXME: check this decently
-    if (++(*lps) >= G_NODE_LEN/TPC) printf("OOM\n");
+    return;
   }
 }
 
+// Allocates a single node.
+Loc node_alloc_1(Net* net, TM* tm) {
+  tm->stat.alloc += 1;
+  if (tm->nfre == 0) {
+    node_refill(net, tm, 1);
+  }
+  return tm->nfre_buf[--tm->nfre];
+}
+
+// Allocates a single var.
+Loc vars_alloc_1(Net* net, TM* tm) {
+  tm->stat.alloc += 1;
+  if (tm->vfre == 0) {
+    vars_refill(net, tm, 1);
+  }
+  return tm->vfre_buf[--tm->vfre];
+}
+
+// Allocates more nodes than fit on the free stack, in chunks.
+static u32 node_alloc_many(Net* net, TM* tm, u32 num) {
+  for (u32 i = 0; i < num;) {
+    u32 len = min(num - i, FREE_LEN);
+    if (tm->nfre < len) {
+      node_refill(net, tm, len);
+    }
+    for (u32 j = 0; j < len; ++j, ++i) {
+      tm->nloc[i] = tm->nfre_buf[--tm->nfre];
+      node_create(net, tm->nloc[i], new_pair(NONE, NONE)); // held
+    }
+  }
+  return num;
+}
+
+// Allocates more vars than fit on the free stack, in chunks.
+static u32 vars_alloc_many(Net* net, TM* tm, u32 num) {
+  for (u32 i = 0; i < num;) {
+    u32 len = min(num - i, FREE_LEN);
+    if (tm->vfre < len) {
+      vars_refill(net, tm, len);
+    }
+    for (u32 j = 0; j < len; ++j, ++i) {
+      tm->vloc[i] = tm->vfre_buf[--tm->vfre];
+      vars_create(net, tm->vloc[i], NONE); // held
+    }
+  }
+  return num;
+}
+
+// Allocates `num` nodes on `tm->nloc`. Returns `num` (exits if out of memory).
 u32 node_alloc(Net* net, TM* tm, u32 num) {
-  u32 got = 0;
-  u32 lps = 0;
-  while (got < num) {
-    u32 lc = tm->tid*(G_NODE_LEN/TPC) + (tm->nput%(G_NODE_LEN/TPC));
-    Pair elem = net->node_buf[lc];
-    tm->nput += 1;
-    if (lc > 0 && elem == 0) {
-      tm->nloc[got++] = lc;
+  node_count(net, tm, num);
+  tm->stat.alloc += num;
+  if (tm->nfre < num) {
+    if (num > FREE_LEN) {
+      return node_alloc_many(net, tm, num);
     }
-    // FIXME: check this decently
-    if (++lps >= G_NODE_LEN/TPC) printf("OOM\n");
+    node_refill(net, tm, num);
   }
-  return got;
+  for (u32 i = 0; i < num; ++i) {
+    tm->nloc[i] = tm->nfre_buf[--tm->nfre];
+  }
+  return num;
 }
 
+// Allocates `num` vars on `tm->vloc`. Returns `num` (exits if out of memory).
 u32 vars_alloc(Net* net, TM* tm, u32 num) {
-  u32 got = 0;
-  u32 lps = 0;
-  while (got < num) {
-    u32 lc = tm->tid*(G_NODE_LEN/TPC) + (tm->vput%(G_NODE_LEN/TPC));
-    Port elem = net->vars_buf[lc];
-    tm->vput += 1;
-    if (lc > 0 && elem == 0) {
-      tm->vloc[got++] = lc;
+  tm->stat.alloc += num;
+  if (tm->vfre < num) {
+    if (num > FREE_LEN) {
+      return vars_alloc_many(net, tm, num);
     }
-    // FIXME: check this decently
-    if (++lps >= G_NODE_LEN/TPC) printf("OOM\n");
+    vars_refill(net, tm, num);
   }
-  return got;
+  for (u32 i = 0; i < num; ++i) {
+    tm->vloc[i] = tm->vfre_buf[--tm->vfre];
+  }
+  return num;
 }
 
-// Gets the necessary resources for an interaction. Returns success.
+// Gets the necessary resources for an interaction. Returns success. Redexes
+// always fit (the deque grows, and the hbag spills to it), so `need_rbag` is
+// only checked by the CUDA runtime. The nodes are counted as live, so callers
+// check availability first: an interaction that allocates can't fail anymore.
 static inline bool get_resources(Net* net, TM* tm, u32 need_rbag, u32 need_node, u32 need_vars) {
-  u32 got_rbag = min(RLEN - tm->rput, HLEN - tm->hput);
   u32 got_node = node_alloc(net, tm, need_node);
   u32 got_vars = vars_alloc(net, tm, need_vars);
 
-  return got_rbag >= need_rbag && got_node >= need_node && got_vars >= need_vars;
+  return got_node >= need_node && got_vars >= need_vars;
 }
 
 // Linking
@@ -792,7 +2412,8 @@ static inline Port peek(Net* net, Port var) {
 }
 
 // Finds a variable's value.
-static inline Port enter(Net* net, Port var) {
+static inline Port enter(Net* net, TM* tm, Port var) {
+  tm->stat.enter += 1;
   // While `B` is VAR: extend it (as an optimization)
   while (get_tag(var) == VAR) {
     // Takes the current `var` substitution as `val`
@@ -802,14 +2423,16 @@ static inline Port enter(Net* net, Port var) {
       break;
     }
     // Otherwise, delete `B` (we own both) and continue
-    vars_take(net, get_val(var));
+    vars_take(net, tm, get_val(var));
     var = val;
+    tm->stat.enter_hops += 1;
   }
   return var;
 }
 
 // Atomically Links `A ~ B`.
 static inline void link(Net* net, TM* tm, Port A, Port B) {
+  tm->stat.link += 1;
   // Attempts to directionally point `A ~> B`
   while (true) {
     // If `A` is NODE: swap `A` and `B`, and continue
@@ -824,7 +2447,7 @@ static inline void link(Net* net, TM* tm, Port A, Port B) {
     }
 
     // Extends B (as an optimization)
-    B = enter(net, B);
+    B = enter(net, tm, B);
 
     // Since `A` is VAR: point `A ~> B`.
     // Stores `A -> B`, taking the current `A` subst as `A'`
@@ -835,8 +2458,9 @@ static inline void link(Net* net, TM* tm, Port A, Port B) {
     }
     //if (A_ == 0) { ? } // FIXME: must handle on the move-to-global algo
     // Otherwise, delete `A` (we own both) and link `A' ~ B`
-    vars_take(net, get_val(A));
+    vars_take(net, tm, get_val(A));
     A = A_;
+    tm->stat.link_hops += 1;
   }
 }
 
@@ -872,7 +2496,7 @@ static inline bool interact_eras(Net* net, TM* tm, Port a, Port b);
 static inline bool interact_call(Net* net, TM* tm, Port a, Port b, Book* book) {
   // Loads Definition.
   u32  fid = get_val(a) & 0xFFFFFFF;
-  Def* def = &book->defs_buf[fid];
+  Def* def = book_def(book, fid);
 
   // Copy Optimization.
   if (def->safe && get_tag(b) == DUP) {
@@ -885,19 +2509,27 @@ static inline bool interact_call(Net* net, TM* tm, Port a, Port b, Book* book) {
     return false;
   }
 
+  // Profiles the call.
+  PROBE2(call, tm->tid, fid);
+  if (tm->prof) {
+    prof_call(tm, fid);
+  }
+
   // Stores new vars.
   for (u32 i = 0; i < def->vars_len; ++i) {
     vars_create(net, tm->vloc[i], NONE);
   }
 
   // Stores new nodes.
+  Pair* node_buf = def_node_buf(def);
   for (u32 i = 0; i < def->node_len; ++i) {
-    node_create(net, tm->nloc[i], adjust_pair(net, tm, def->node_buf[i]));
+    node_create(net, tm->nloc[i], adjust_pair(net, tm, node_buf[i]));
   }
 
   // Links.
+  Pair* rbag_buf = def_rbag_buf(def);
   for (u32 i = 0; i < def->rbag_len; ++i) {
-    link_pair(net, tm, adjust_pair(net, tm, def->rbag_buf[i]));
+    link_pair(net, tm, adjust_pair(net, tm, rbag_buf[i]));
   }
   link_pair(net, tm, new_pair(adjust_port(net, tm, def->root), b));
 
@@ -924,7 +2556,7 @@ static inline bool interact_eras(Net* net, TM* tm, Port a, Port b) {
   }
 
   // Loads ports.
-  Pair B  = node_exchange(net, get_val(b), 0);
+  Pair B  = node_take(net, tm, get_val(b));
   Port B1 = get_fst(B);
   Port B2 = get_snd(B);
 
@@ -949,10 +2581,10 @@ static inline bool interact_anni(Net* net, TM* tm, Port a, Port b) {
   }
 
   // Loads ports.
-  Pair A  = node_take(net, get_val(a));
+  Pair A  = node_take(net, tm, get_val(a));
   Port A1 = get_fst(A);
   Port A2 = get_snd(A);
-  Pair B  = node_take(net, get_val(b));
+  Pair B  = node_take(net, tm, get_val(b));
   Port B1 = get_fst(B);
   Port B2 = get_snd(B);
 
@@ -965,22 +2597,22 @@ static inline bool interact_anni(Net* net, TM* tm, Port a, Port b) {
 
 // The Comm Interaction.
 static inline bool interact_comm(Net* net, TM* tm, Port a, Port b) {
-  // Allocates needed nodes and vars.
-  if (!get_resources(net, tm, 4, 4, 4)) {
-    debug("interact_comm: get_resources failed\n");
+  // Checks availability (first, so a redex that is retried allocates nothing)
+  if (node_load(net, get_val(a)) == 0 || node_load(net, get_val(b)) == 0) {
     return false;
   }
 
-  // Checks availability
-  if (node_load(net, get_val(a)) == 0 || node_load(net, get_val(b)) == 0) {
+  // Allocates needed nodes and vars.
+  if (!get_resources(net, tm, 4, 4, 4)) {
+    debug("interact_comm: get_resources failed\n");
     return false;
   }
 
   // Loads ports.
-  Pair A  = node_take(net, get_val(a));
+  Pair A  = node_take(net, tm, get_val(a));
   Port A1 = get_fst(A);
   Port A2 = get_snd(A);
-  Pair B  = node_take(net, get_val(b));
+  Pair B  = node_take(net, tm, get_val(b));
   Port B1 = get_fst(B);
   Port B2 = get_snd(B);
 
@@ -1005,30 +2637,50 @@ static inline bool interact_comm(Net* net, TM* tm, Port a, Port b) {
   return true;
 }
 
+// Evaluates the deferred OPER redexes, linking back their results.
+static void oper_flush(Net* net, TM* tm) {
+  Numb cs[OPER_BATCH_MAX];
+  u32  len = tm->olen;
+  oper_eval(len, tm->oper_a, tm->oper_b, cs);
+  tm->olen = 0;
+  for (u32 i = 0; i < len; ++i) {
+    link_pair(net, tm, new_pair(new_port(NUM, cs[i]), tm->oper_out[i]));
+  }
+}
+
 // The Oper Interaction.
 static inline bool interact_oper(Net* net, TM* tm, Port a, Port b) {
-  // Allocates needed nodes and vars.
-  if (!get_resources(net, tm, 1, 1, 0)) {
-    debug("interact_oper: get_resources failed\n");
+  // Checks availability (first, so a redex that is retried allocates nothing)
+  if (node_load(net, get_val(b)) == 0) {
     return false;
   }
 
-  // Checks availability
-  if (node_load(net, get_val(b)) == 0) {
+  // Allocates needed nodes and vars.
+  if (!get_resources(net, tm, 1, 1, 0)) {
+    debug("interact_oper: get_resources failed\n");
     return false;
   }
 
   // Loads ports.
   Val  av = get_val(a);
-  Pair B  = node_take(net, get_val(b));
+  Pair B  = node_take(net, tm, get_val(b));
   Port B1 = get_fst(B);
-  Port B2 = enter(net, get_snd(B));
-
-  // Performs operation.
-  if (get_tag(B1) == NUM) {
+  Port B2 = enter(net, tm, get_snd(B));
+
+  // Performs operation (or defers it, to evaluate it in a batch).
+  if (get_tag(B1) == NUM && OPTS.oper_batch > 0) {
+    tm->oper_a[tm->olen] = av;
+    tm->oper_b[tm->olen] = get_val(B1);
+    tm->oper_out[tm->olen] = B2;
+    node_drop(net, tm, tm->nloc[0]);
+    if (++tm->olen >= OPTS.oper_batch) {
+      oper_flush(net, tm);
+    }
+  } else if (get_tag(B1) == NUM) {
     Val  bv = get_val(B1);
     Numb cv = operate(av, bv);
     link_pair(net, tm, new_pair(new_port(NUM, cv), B2));
+    node_drop(net, tm, tm->nloc[0]);
   } else {
     node_create(net, tm->nloc[0], new_pair(a, B2));
     link_pair(net, tm, new_pair(B1, new_port(OPR, tm->nloc[0])));
@@ -1039,20 +2691,20 @@ static inline bool interact_oper(Net* net, TM* tm, Port a, Port b) {
 
 // The Swit Interaction.
 static inline bool interact_swit(Net* net, TM* tm, Port a, Port b) {
-  // Allocates needed nodes and vars.
-  if (!get_resources(net, tm, 1, 2, 0)) {
-    debug("interact_swit: get_resources failed\n");
+  // Checks availability (first, so a redex that is retried allocates nothing)
+  if (node_load(net, get_val(b)) == 0) {
     return false;
   }
 
-  // Checks availability
-  if (node_load(net, get_val(b)) == 0) {
+  // Allocates needed nodes and vars.
+  if (!get_resources(net, tm, 1, 2, 0)) {
+    debug("interact_swit: get_resources failed\n");
     return false;
   }
 
   // Loads ports.
   u32  av = get_u24(get_val(a));
-  Pair B  = node_take(net, get_val(b));
+  Pair B  = node_take(net, tm, get_val(b));
   Port B1 = get_fst(B);
   Port B2 = get_snd(B);
 
@@ -1060,128 +2712,817 @@ static inline bool interact_swit(Net* net, TM* tm, Port a, Port b) {
   if (av == 0) {
     node_create(net, tm->nloc[0], new_pair(B2, new_port(ERA,0)));
     link_pair(net, tm, new_pair(new_port(CON, tm->nloc[0]), B1));
+    node_drop(net, tm, tm->nloc[1]);
   } else {
     node_create(net, tm->nloc[0], new_pair(new_port(ERA,0), new_port(CON, tm->nloc[1])));
     node_create(net, tm->nloc[1], new_pair(new_port(NUM, new_u24(av-1)), B2));
     link_pair(net, tm, new_pair(new_port(CON, tm->nloc[0]), B1));
   }
 
-  return true;
+  return true;
+}
+
+// Pops a local redex and performs a single interaction.
+// Reduces a redex. Returns success (if not, the redex is pushed back).
+static inline bool interact_redex(Net* net, TM* tm, Book* book, Pair redex) {
+  // Gets redex ports A and B.
+  Port a = get_fst(redex);
+  Port b = get_snd(redex);
+
+  // Gets the rule type.
+  Rule rule = get_rule(a, b);
+
+  // Used for root redex.
+  if (get_tag(a) == REF && b == ROOT) {
+    rule = CALL;
+  // Swaps ports if necessary.
+  } else if (should_swap(a,b)) {
+    swap(&a, &b);
+  }
+
+  // Dispatches interaction rule.
+  bool success = false;
+  switch (rule) {
+    case LINK: success = interact_link(net, tm, a, b); break;
+    #ifdef COMPILED
+    case CALL: success = interact_call(net, tm, a, b); break;
+    #else
+    case CALL: success = interact_call(net, tm, a, b, book); break;
+    #endif
+    case VOID: success = interact_void(net, tm, a, b); break;
+    case ERAS: success = interact_eras(net, tm, a, b); break;
+    case ANNI: success = interact_anni(net, tm, a, b); break;
+    case COMM: success = interact_comm(net, tm, a, b); break;
+    case OPER: success = interact_oper(net, tm, a, b); break;
+    case SWIT: success = interact_swit(net, tm, a, b); break;
+  }
+
+  // If error, pushes redex back.
+  if (!success) {
+    tm->stat.fail[rule] += 1;
+    PROBE2(interact_fail, tm->tid, rule);
+    push_redex(net, tm, redex);
+    return false;
+  // Else, increments the interaction count.
+  } else if (rule != LINK) {
+    tm->itrs += 1;
+  }
+  tm->stat.rule[rule] += 1;
+
+  return true;
+}
+
+static inline bool interact(Net* net, TM* tm, Book* book) {
+  // Pops a redex.
+  Pair redex = pop_redex(net, tm);
+
+  // If there is no redex, stop.
+  if (redex != 0) {
+    return interact_redex(net, tm, book, redex);
+  }
+
+  return true;
+}
+
+// Prefetches the node or var a port points to.
+static inline void prefetch_port(Net* net, Port port) {
+  if (is_nod(port)) {
+    __builtin_prefetch(&net->node_buf[get_val(port)], 1);
+  } else if (is_var(port)) {
+    __builtin_prefetch(&net->vars_buf[get_val(port)], 1);
+  }
+}
+
+// Prefetches what the nodes of a redex point to. Their lines should already
+// be cached (or in flight), so the loads are cheap.
+static inline void prefetch_aux(Net* net, Pair redex) {
+  Port ps[2] = {get_fst(redex), get_snd(redex)};
+  for (u32 i = 0; i < 2; ++i) {
+    if (is_nod(ps[i])) {
+      Pair node = node_load(net, get_val(ps[i]));
+      prefetch_port(net, get_fst(node));
+      prefetch_port(net, get_snd(node));
+    }
+  }
+}
+
+// Pops up to `len` redexes and reduces them together: first the lines of all
+// their nodes and vars are prefetched, then each is reduced while the ports of
+// the next one are prefetched. That way, the cache misses of a batch overlap
+// instead of stalling one at a time, which pays off once the heap outgrows the
+// last-level cache. Returns success.
+static inline bool interact_batch(Net* net, TM* tm, Book* book, u32 len) {
+  Pair batch[BATCH_MAX];
+  u32  got = 0;
+  while (got < len) {
+    Pair redex = pop_redex(net, tm);
+    if (redex == 0) {
+      break;
+    }
+    prefetch_port(net, get_fst(redex));
+    prefetch_port(net, get_snd(redex));
+    batch[got++] = redex;
+  }
+  bool success = true;
+  for (u32 i = 0; i < got; ++i) {
+    if (i + 1 < got) {
+      prefetch_aux(net, batch[i + 1]);
+    }
+    success &= interact_redex(net, tm, book, batch[i]);
+  }
+  return success;
+}
+
+#ifdef THREADED_DISPATCH
+// Reduces redexes until the local bags run dry, as threaded code: a table of
+// labels, indexed by the tags of both ports, leads straight to the rule, with
+// the swap already decided, so there is no get_rule, should_swap or switch.
+// Each rule ends with its own copy of the dispatch, so the branch predictor
+// learns what usually follows it (e.g. LINK after ANNI, ERAS after COMM).
+// Returns success (if not, the failed redex is pushed back).
+static inline bool interact_threaded(Net* net, TM* tm, Book* book) {
+  static void* const DISPATCH[64] = {
+    //VAR              REF              ERA              NUM              CON              DUP              OPR              SWI
+    &&rule_link,     &&rule_link,     &&rule_link,     &&rule_link,     &&rule_link,     &&rule_link,     &&rule_link,     &&rule_link, // VAR
+    &&rule_link_swap,&&rule_void,     &&rule_void,     &&rule_void,     &&rule_call,     &&rule_call,     &&rule_call,     &&rule_call, // REF
+    &&rule_link_swap,&&rule_void,     &&rule_void,     &&rule_void,     &&rule_eras,     &&rule_eras,     &&rule_eras,     &&rule_eras, // ERA
+    &&rule_link_swap,&&rule_void,     &&rule_void,     &&rule_void,     &&rule_eras,     &&rule_eras,     &&rule_oper,     &&rule_swit, // NUM
+    &&rule_link_swap,&&rule_call_swap,&&rule_eras_swap,&&rule_eras_swap,&&rule_anni,     &&rule_comm,     &&rule_comm,     &&rule_comm, // CON
+    &&rule_link_swap,&&rule_call_swap,&&rule_eras_swap,&&rule_eras_swap,&&rule_comm_swap,&&rule_anni,     &&rule_comm,     &&rule_comm, // DUP
+    &&rule_link_swap,&&rule_call_swap,&&rule_eras_swap,&&rule_oper_swap,&&rule_comm_swap,&&rule_comm_swap,&&rule_anni,     &&rule_comm, // OPR
+    &&rule_link_swap,&&rule_call_swap,&&rule_eras_swap,&&rule_swit_swap,&&rule_comm_swap,&&rule_comm_swap,&&rule_comm_swap,&&rule_anni, // SWI
+  };
+
+  Pair redex;
+  Port a;
+  Port b;
+
+  // Pops the next redex and jumps to its rule, stopping if there is none.
+  #define DISPATCH_NEXT() \
+    redex = pop_redex(net, tm); \
+    if (redex == 0) { \
+      return true; \
+    } \
+    a = get_fst(redex); \
+    b = get_snd(redex); \
+    goto *DISPATCH[get_tag(a) << 3 | get_tag(b)];
+
+  // Counts the interaction, or pushes the redex back if it failed.
+  #define DISPATCH_DONE(success, r) \
+    if (!(success)) { \
+      tm->stat.fail[r] += 1; \
+      PROBE2(interact_fail, tm->tid, r); \
+      push_redex(net, tm, redex); \
+      return false; \
+    } \
+    tm->itrs += r != LINK; \
+    tm->stat.rule[r] += 1; \
+    DISPATCH_NEXT();
+
+  DISPATCH_NEXT();
+
+  rule_link_swap:
+    // Used for root redex.
+    if (get_tag(a) == REF && b == ROOT) {
+      goto rule_call;
+    }
+    swap(&a, &b);
+  rule_link:
+    DISPATCH_DONE(interact_link(net, tm, a, b), LINK);
+
+  rule_call_swap:
+    swap(&a, &b);
+  rule_call:
+    #ifdef COMPILED
+    DISPATCH_DONE(interact_call(net, tm, a, b), CALL);
+    #else
+    DISPATCH_DONE(interact_call(net, tm, a, b, book), CALL);
+    #endif
+
+  rule_void:
+    DISPATCH_DONE(interact_void(net, tm, a, b), VOID);
+
+  rule_eras_swap:
+    swap(&a, &b);
+  rule_eras:
+    DISPATCH_DONE(interact_eras(net, tm, a, b), ERAS);
+
+  rule_anni:
+    DISPATCH_DONE(interact_anni(net, tm, a, b), ANNI);
+
+  rule_comm_swap:
+    swap(&a, &b);
+  rule_comm:
+    DISPATCH_DONE(interact_comm(net, tm, a, b), COMM);
+
+  rule_oper_swap:
+    swap(&a, &b);
+  rule_oper:
+    DISPATCH_DONE(interact_oper(net, tm, a, b), OPER);
+
+  rule_swit_swap:
+    swap(&a, &b);
+  rule_swit:
+    DISPATCH_DONE(interact_swit(net, tm, a, b), SWIT);
+
+  #undef DISPATCH_NEXT
+  #undef DISPATCH_DONE
+}
+#endif
+
+// Evaluator
+// ---------
+
+// Max redexes taken by one steal.
+#define STEAL_MAX 256
+
+// Xorshift, for picking victims.
+static inline u32 tm_rand(TM* tm) {
+  tm->seed ^= tm->seed << 13;
+  tm->seed ^= tm->seed >> 17;
+  tm->seed ^= tm->seed << 5;
+  return tm->seed;
+}
+
+// Max time an idle thread sleeps before looking for work again. Wakeups are
+// cheap and may be missed, so this bounds how long work waits for a thief.
+#define PARK_NS 4000000
+
+// Marks a thread as idle. If it was the last busy one, the normalization is
+// over: sets `done` and wakes everyone. Returns whether that happened.
+static inline bool idle_enter(Net* net) {
+  if (atomic_fetch_add_explicit(&net->idle, 1, memory_order_acq_rel) == TPC - 1) {
+    atomic_store_explicit(&net->done, 1, memory_order_release);
+    atomic_fetch_add_explicit(&net->park, 1, memory_order_release);
+    futex_wake(&net->park, INT_MAX);
+    return true;
+  }
+  return false;
+}
+
+// Checks if any thread has redexes to steal.
+static inline bool net_has_work(Net* net) {
+  for (u32 t = 0; t < TPC; ++t) {
+    if (deque_len(net, t) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Sleeps until woken by new work or termination, or PARK_NS passes.
+static inline void park(Net* net) {
+  atomic_fetch_add_explicit(&net->sleep, 1, memory_order_seq_cst);
+  u32 seq = atomic_load_explicit(&net->park, memory_order_seq_cst);
+  if (!atomic_load_explicit(&net->done, memory_order_acquire) && !net_has_work(net)) {
+    futex_wait(&net->park, seq, PARK_NS);
+  }
+  atomic_fetch_sub_explicit(&net->sleep, 1, memory_order_relaxed);
+}
+
+// Takes the redex handed to us, if any.
+static inline bool inbox_take(Net* net, TM* tm) {
+  Inbox* box = &net->inbox[tm->tid];
+  Pair redex = atomic_load_explicit(&box->redex, memory_order_acquire);
+  if (redex == 0) {
+    return false;
+  }
+  atomic_store_explicit(&box->redex, 0, memory_order_relaxed);
+  tm->open = false;
+  push_redex(net, tm, redex);
+  return true;
+}
+
+// Opens our inbox. Only idle threads do.
+static inline void inbox_open(Net* net, TM* tm) {
+  if (!tm->open) {
+    tm->open = true;
+    atomic_store_explicit(&net->inbox[tm->tid].open, 1, memory_order_release);
+  }
+}
+
+// Closes our inbox, before finding work elsewhere or parking. If a thread
+// already claimed it (counting us as busy), waits for its redex and takes
+// it. Returns whether we got one.
+static inline bool inbox_close(Net* net, TM* tm) {
+  if (!tm->open) {
+    return false;
+  }
+  u32 open = 1;
+  tm->open = false;
+  if (atomic_compare_exchange_strong_explicit(&net->inbox[tm->tid].open, &open, 0, memory_order_acq_rel, memory_order_relaxed)) {
+    return false;
+  }
+  while (!inbox_take(net, tm)) {
+    cpu_relax();
+  }
+  return true;
+}
+
+// Moves up to half of a victim's deque to ours, counting it as a steal at
+// level `lvl`. Returns how many redexes were taken, or 1 if a redex was
+// handed to us instead. Only idle threads steal, and count as busy while
+// they hold the stolen redexes, so `idle` reaching TPC means there's no work
+// anywhere.
+static inline u32 steal_half(Net* net, TM* tm, u32 vic, u32 lvl) {
+  u32 len = deque_len(net, vic);
+  if (len == 0) {
+    return 0;
+  }
+  if (inbox_close(net, tm)) {
+    return 1;
+  }
+  atomic_fetch_sub_explicit(&net->idle, 1, memory_order_acq_rel);
+  u32 max = min((len + 1) / 2, STEAL_MAX);
+  u32 got = 0;
+  while (got < max) {
+    Pair redex = take_redex(net, vic);
+    if (redex == 0) {
+      break;
+    }
+    push_redex(net, tm, redex);
+    got += 1;
+  }
+  if (got == 0) {
+    idle_enter(net);
+  }
+  tm->stls[lvl] += got;
+  return got;
+}
+
+// Steals redexes from a random victim sharing our core, else from one
+// sharing our cache, and so on outwards (see STEAL_*). Returns how many
+// redexes were taken.
+static inline u32 steal(Net* net, TM* tm) {
+  u32 ini = 0;
+  for (u32 l = 0; l < STEAL_LEVELS; ++l) {
+    u32 end = tm->vend[l];
+    if (end > ini) {
+      u32 vic = tm->vics_buf[ini + tm_rand(tm) % (end - ini)];
+      u32 got = steal_half(net, tm, vic, l);
+      tm->stat.steal_try += 1;
+      PROBE4(steal, tm->tid, vic, l, got);
+      if (got > 0) {
+        tm->stat.steal_hit += 1;
+        return got;
+      }
+    }
+    ini = end;
+  }
+  return 0;
+}
+
+void evaluator(Net* net, TM* tm, Book* book) {
+  // Initializes the global idle counter. Thread 0 starts busy, with the
+  // initial redex.
+  atomic_store_explicit(&net->idle, TPC - 1, memory_order_relaxed);
+  atomic_store_explicit(&net->done, 0, memory_order_relaxed);
+  Trace* tr  = tm->trace;
+  u64    ini = trace_now(tr);
+  sync_threads();
+  trace_span(tr, TRACE_SYNC, ini, 0);
+
+  // Performs some interactions
+  bool busy  = tm->tid == 0;
+  u32  spin  = 0;
+  u32  batch = OPTS.batch;
+  ini = trace_now(tr);
+  while (true) {
+    // If we have redexes...
+    if (rbag_len(net, tm) > 0) {
+      // Perform an interaction (or a batch of them, or as many as we have)
+      bool ok;
+      if (batch > 1) {
+        ok = interact_batch(net, tm, book, batch);
+      } else {
+        #ifdef THREADED_DISPATCH
+        ok = interact_threaded(net, tm, book);
+        #else
+        ok = interact(net, tm, book);
+        #endif
+      }
+      if (!ok) {
+        debug("interaction failed\n");
+      }
+    // If we deferred OPER redexes, evaluate them before idling
+    } else if (tm->olen > 0) {
+      oper_flush(net, tm);
+    // If we have no redexes...
+    } else {
+      // Update global idle counter, halting if all threads are idle
+      if (busy) {
+        busy = false;
+        trace_span(tr, TRACE_BUSY, ini, 0);
+        ini = trace_now(tr);
+        if (idle_enter(net)) {
+          break;
+        }
+      }
+      if (atomic_load_explicit(&net->done, memory_order_acquire)) {
+        break;
+      }
+
+      // Takes a parallel redex handed to us, else steals half of a random
+      // victim's redexes
+      if (inbox_take(net, tm) || steal(net, tm) > 0) {
+        busy = true;
+        spin = 0;
+        trace_span(tr, TRACE_IDLE, ini, 0);
+        ini = trace_now(tr);
+        continue;
+      }
+
+      // Chill, with our inbox open...
+      if (++spin < SPIN_LEN) {
+        inbox_open(net, tm);
+        cpu_relax();
+      } else if (inbox_close(net, tm)) {
+        busy = true;
+        spin = 0;
+        trace_span(tr, TRACE_IDLE, ini, 0);
+        ini = trace_now(tr);
+      } else {
+        spin = 0;
+        park(net);
+      }
+    }
+  }
+
+  trace_span(tr, TRACE_IDLE, ini, 0);
+
+  // Everyone is idle, so nobody is handing us redexes
+  atomic_store_explicit(&net->inbox[tm->tid].open, 0, memory_order_relaxed);
+  tm->open = false;
+
+  ini = trace_now(tr);
+  sync_threads();
+  trace_span(tr, TRACE_SYNC, ini, 0);
+
+  // Nobody is stealing now, so the rings our deque outgrew can go
+  Ring* ring = atomic_load_explicit(&net->deqs[tm->tid].ring, memory_order_relaxed);
+  ring_free(ring->old);
+  ring->old = NULL;
+
+  if (tm->prof) {
+    prof_flush(tm);
+    tm->prof->mark = 0;
+  }
+  atomic_fetch_add(&net->itrs, tm->itrs);
+  atomic_fetch_add(&net->give, tm->give);
+  sched_update(net, tm);
+  tm->nmax = tm->nput > tm->nmax ? tm->nput : tm->nmax;
+  tm->vmax = tm->vput > tm->vmax ? tm->vput : tm->vmax;
+  tm->itrs = 0;
+  tm->give = 0;
+  for (u32 l = 0; l < STEAL_LEVELS; ++l) {
+    atomic_fetch_add(&net->stls[l], tm->stls[l]);
+    tm->stls[l] = 0;
+  }
+}
+
+// NUMA
+// ----
+
+// On machines with many NUMA nodes, threads are spread over the nodes in
+// contiguous blocks and pinned to their node's cpus (unless `--pin` places
+// them). Each thread's slices of node_buf and vars_buf prefer memory on its
+// node, its deque grows into memory it touches first, and threads on a node
+// read from a local replica of the book.
+
+#define NUMA_MAX 64
+
+// mbind(2), called directly to avoid depending on libnuma.
+#define MPOL_PREFERRED 1
+
+typedef struct {
+  u32 nodes; // NUMA nodes with cpus (1 if unknown)
+  u32 node[TPC_MAX]; // node of each thread
+  u8  cpu_node[CPU_SETSIZE]; // node of each cpu
+  cpu_set_t cpus[NUMA_MAX]; // cpus of each node
+  Book* book; // replicated book
+  Book* books[NUMA_MAX]; // book replica of each node
+  u64 books_size; // size of each replica, in bytes
+} Numa;
+
+static Numa NUMA = { .nodes = 1 };
+
+// Parses a sysfs cpu list (e.g. "0-3,8-11").
+static void numa_parse_cpus(const char* str, cpu_set_t* set) {
+  CPU_ZERO(set);
+  while (*str != '\0' && *str != '\n') {
+    char* end;
+    u32 ini = strtoul(str, &end, 10);
+    u32 fin = ini;
+    if (end == str) {
+      return;
+    }
+    if (*end == '-') {
+      fin = strtoul(end + 1, &end, 10);
+    }
+    for (u32 cpu = ini; cpu <= fin && cpu < CPU_SETSIZE; ++cpu) {
+      CPU_SET(cpu, set);
+    }
+    str = *end == ',' ? end + 1 : end;
+  }
+}
+
+// Prefers memory on a NUMA node for an address range.
+static void numa_bind(void* ptr, u64 len, u32 node) {
+  unsigned long mask[NUMA_MAX / 64] = {0};
+  mask[node / 64] = 1ul << (node % 64);
+  syscall(SYS_mbind, ptr, len, MPOL_PREFERRED, mask, NUMA_MAX + 1, 0);
+}
+
+// Reads the NUMA topology, assigning threads to nodes.
+void numa_init() {
+  u32 ids[NUMA_MAX];
+  NUMA.nodes = 0;
+  for (u32 id = 0; id < NUMA_MAX; ++id) {
+    char path[128];
+    char list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", id);
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+      continue;
+    }
+    if (fgets(list, sizeof(list), file) != NULL) {
+      numa_parse_cpus(list, &NUMA.cpus[NUMA.nodes]);
+      for (u32 cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &NUMA.cpus[NUMA.nodes])) {
+          NUMA.cpu_node[cpu] = id;
+        }
+      }
+      if (CPU_COUNT(&NUMA.cpus[NUMA.nodes]) > 0) {
+        ids[NUMA.nodes++] = id;
+      }
+    }
+    fclose(file);
+  }
+  if (NUMA.nodes <= 1 || TPC < 2) {
+    NUMA.nodes = 1;
+    return;
+  }
+  if (NUMA.nodes > TPC) {
+    NUMA.nodes = TPC;
+  }
+
+  // Assigns threads to nodes, in contiguous blocks. Stores the real node
+  // ids, for mbind.
+  for (u32 t = 0; t < TPC; ++t) {
+    NUMA.node[t] = ids[t * NUMA.nodes / TPC];
+  }
+  for (u32 n = NUMA.nodes; n-- > 0;) {
+    NUMA.cpus[ids[n]] = NUMA.cpus[n];
+  }
+}
+
+// Binds each thread's slices of the net to its node.
+void numa_bind_net(Net* net) {
+  if (NUMA.nodes <= 1) {
+    return;
+  }
+  for (u32 t = 0; t < TPC; ++t) {
+    numa_bind(&net->node_buf[t*NODE_SLICE], NODE_SLICE * sizeof(ANode), NUMA.node[t]);
+    numa_bind(&net->vars_buf[t*VARS_SLICE], VARS_SLICE * sizeof(APort), NUMA.node[t]);
+  }
+}
+
+// Frees the book replicas.
+void numa_free_books() {
+  for (u32 n = 0; n < NUMA_MAX; ++n) {
+    if (NUMA.books[n] != NULL) {
+      munmap(NUMA.books[n], NUMA.books_size);
+      NUMA.books[n] = NULL;
+    }
+  }
+  NUMA.book = NULL;
 }
 
-// Pops a local redex and performs a single interaction.
-static inline bool interact(Net* net, TM* tm, Book* book) {
-  // Pops a redex.
-  Pair redex = pop_redex(net, tm);
+// Gets the book replica for a thread's node, making replicas as needed. The
+// defs are copied; names and foreign functions are shared.
+Book* numa_book(Book* book, u32 tid) {
+  if (NUMA.nodes <= 1 || book == NULL) {
+    return book;
+  }
+  if (NUMA.book != book) {
+    numa_free_books();
+    NUMA.book = book;
+    NUMA.books_size = sizeof(Book) + book->defs_len * sizeof(u64) + book->defs_size;
+  }
+  u32 node = NUMA.node[tid];
+  if (NUMA.books[node] == NULL) {
+    u8* buf = mmap(NULL, NUMA.books_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+      return book;
+    }
+    numa_bind(buf, NUMA.books_size, node);
+    Book* rep = (Book*)buf;
+    *rep = *book;
+    rep->defs_off = (u64*)(buf + sizeof(Book));
+    rep->defs_buf = buf + sizeof(Book) + book->defs_len * sizeof(u64);
+    memcpy(rep->defs_off, book->defs_off, book->defs_len * sizeof(u64));
+    memcpy(rep->defs_buf, book->defs_buf, book->defs_size);
+    NUMA.books[node] = rep;
+  }
+  return NUMA.books[node];
+}
 
-  // If there is no redex, stop.
-  if (redex != 0) {
-    // Gets redex ports A and B.
-    Port a = get_fst(redex);
-    Port b = get_snd(redex);
+// Topology
+// --------
 
-    // Gets the rule type.
-    Rule rule = get_rule(a, b);
+// Each thread's place is named by one group per steal level: the first cpu
+// of its core and of its last-level cache, its NUMA node and its socket.
+// Threads not pinned to a cpu get a core and cache of their own. Each thread
+// lists its victims by the nearest level they share, so that steals stay
+// within a core or cache (e.g. a CCX) while there's work there.
 
-    // Used for root redex.
-    if (get_tag(a) == REF && b == ROOT) {
-      rule = CALL;
-    // Swaps ports if necessary.
-    } else if (should_swap(a,b)) {
-      swap(&a, &b);
-    }
-
-    // Dispatches interaction rule.
-    bool success;
-    switch (rule) {
-      case LINK: success = interact_link(net, tm, a, b); break;
-      #ifdef COMPILED
-      case CALL: success = interact_call(net, tm, a, b); break;
-      #else
-      case CALL: success = interact_call(net, tm, a, b, book); break;
-      #endif
-      case VOID: success = interact_void(net, tm, a, b); break;
-      case ERAS: success = interact_eras(net, tm, a, b); break;
-      case ANNI: success = interact_anni(net, tm, a, b); break;
-      case COMM: success = interact_comm(net, tm, a, b); break;
-      case OPER: success = interact_oper(net, tm, a, b); break;
-      case SWIT: success = interact_swit(net, tm, a, b); break;
-    }
-
-    // If error, pushes redex back.
-    if (!success) {
-      push_redex(net, tm, redex);
-      return false;
-    // Else, increments the interaction count.
-    } else if (rule != LINK) {
-      tm->itrs += 1;
+typedef struct {
+  u32 cpus; // usable cpus
+  u32 cpu[CPU_SETSIZE]; // usable cpus, in pinning order
+  u32 grp[CPU_SETSIZE][STEAL_REMOTE]; // groups of each usable cpu
+  u32 pin[TPC_MAX]; // index in `cpu` of each thread's cpu (with --pin)
+  u32 thr[TPC_MAX][STEAL_REMOTE]; // groups of each thread
+} Topo;
+
+static Topo TOPO;
+
+// Reads the first number of a sysfs file (e.g. of a cpu list), or `def`.
+static u32 topo_read(const char* path, u32 def) {
+  u32 val = def;
+  FILE* file = fopen(path, "r");
+  if (file != NULL) {
+    if (fscanf(file, "%u", &val) != 1) {
+      val = def;
     }
+    fclose(file);
   }
-
-  return true;
+  return val;
 }
 
-// Evaluator
-// ---------
+// Reads a cpu's groups, below STEAL_REMOTE.
+static void topo_cpu(u32 cpu, u32* grp) {
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list", cpu);
+  grp[STEAL_CORE] = topo_read(path, cpu);
+  grp[STEAL_CACHE] = cpu;
+  for (u32 i = 0, top = 0; i < 8; ++i) {
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", cpu, i);
+    u32 lvl = topo_read(path, 0);
+    if (lvl == 0) {
+      break;
+    }
+    if (lvl >= top) {
+      top = lvl;
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list", cpu, i);
+      grp[STEAL_CACHE] = topo_read(path, cpu);
+    }
+  }
+  grp[STEAL_NODE] = NUMA.cpu_node[cpu];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", cpu);
+  grp[STEAL_SOCKET] = topo_read(path, 0);
+}
 
-void evaluator(Net* net, TM* tm, Book* book) {
-  // Initializes the global idle counter
-  atomic_store_explicit(&net->idle, TPC - 1, memory_order_relaxed);
-  sync_threads();
+// Sorts cpus by a packed key.
+typedef struct {
+  u64 key;
+  u32 idx;
+} TopoKey;
+
+static int topo_cmp(const void* a, const void* b) {
+  u64 x = ((const TopoKey*)a)->key;
+  u64 y = ((const TopoKey*)b)->key;
+  return x < y ? -1 : x > y;
+}
 
-  // Performs some interactions
-  u32  tick = 0;
-  bool busy = tm->tid == 0;
-  while (true) {
-    tick += 1;
+// Packs 5 fields of 12 bits, most significant first.
+static u64 topo_pack(u32 a, u32 b, u32 c, u32 d, u32 e) {
+  return (u64)(a & 0xFFF) << 48 | (u64)(b & 0xFFF) << 36 | (u64)(c & 0xFFF) << 24 | (u64)(d & 0xFFF) << 12 | (e & 0xFFF);
+}
 
-    // If we have redexes...
-    if (rbag_len(net, tm) > 0) {
-      // Update global idle counter
-      if (!busy) atomic_fetch_sub_explicit(&net->idle, 1, memory_order_relaxed);
-      busy = true;
-
-      // Perform an interaction
-      #ifdef DEBUG
-      if (!interact(net, tm, book)) debug("interaction failed\n");
-      #else
-      interact(net, tm, book);
-      #endif
-    // If we have no redexes...
-    } else {
-      // Update global idle counter
-      if (busy) atomic_fetch_add_explicit(&net->idle, 1, memory_order_relaxed);
-      busy = false;
+// Orders the usable cpus for the pinning policy. Sorted compactly, each cpu
+// gets a rank within its parent at each level (its socket among sockets, its
+// node within the socket, ..., itself within its core). Policies then sort by
+// these ranks: compact from the socket down, cores by SMT sibling first, and
+// scatter from the SMT sibling up.
+static void topo_order(u32 pin) {
+  static TopoKey keys[CPU_SETSIZE];
+  u32 len = TOPO.cpus;
+  for (u32 i = 0; i < len; ++i) {
+    u32* g = TOPO.grp[i];
+    keys[i].key = topo_pack(g[STEAL_SOCKET], g[STEAL_NODE], g[STEAL_CACHE], g[STEAL_CORE], TOPO.cpu[i]);
+    keys[i].idx = i;
+  }
+  qsort(keys, len, sizeof(TopoKey), topo_cmp);
+  u32 rnk[5] = {0};
+  for (u32 i = 0; i < len; ++i) {
+    if (i > 0) {
+      u32* a = TOPO.grp[keys[i - 1].idx];
+      u32* b = TOPO.grp[keys[i].idx];
+      u32 d = 0;
+      while (d < 4 && a[STEAL_SOCKET - d] == b[STEAL_SOCKET - d]) {
+        ++d;
+      }
+      rnk[d] += 1;
+      for (u32 j = d + 1; j < 5; ++j) {
+        rnk[j] = 0;
+      }
+    }
+    switch (pin) {
+      case PIN_COMPACT: keys[i].key = topo_pack(rnk[0], rnk[1], rnk[2], rnk[3], rnk[4]); break;
+      case PIN_CORES:   keys[i].key = topo_pack(rnk[4], rnk[0], rnk[1], rnk[2], rnk[3]); break;
+      case PIN_SCATTER: keys[i].key = topo_pack(rnk[4], rnk[3], rnk[2], rnk[1], rnk[0]); break;
+    }
+  }
+  qsort(keys, len, sizeof(TopoKey), topo_cmp);
+  u32 cpu[CPU_SETSIZE];
+  u32 grp[CPU_SETSIZE][STEAL_REMOTE];
+  for (u32 i = 0; i < len; ++i) {
+    cpu[i] = TOPO.cpu[keys[i].idx];
+    memcpy(grp[i], TOPO.grp[keys[i].idx], sizeof(grp[i]));
+  }
+  memcpy(TOPO.cpu, cpu, len * sizeof(u32));
+  memcpy(TOPO.grp, grp, len * sizeof(grp[0]));
+}
 
-      //// Peeks a redex from target
-      u32 sid = (tm->tid - 1) % TPC;
-      u32 idx = sid*(G_RBAG_LEN/TPC) + (tm->sidx++);
+// Gets the nearest steal level two threads share.
+static u32 topo_level(u32 a, u32 b) {
+  u32 l = 0;
+  while (l < STEAL_REMOTE && TOPO.thr[a][l] != TOPO.thr[b][l]) {
+    ++l;
+  }
+  return l;
+}
 
-      // Stealing Everything: this will steal all redexes
+// Reads the cpu topology, pins threads to cpus as `--pin` asks, and sorts
+// each thread's steal victims. Must run after numa_init.
+void topo_init() {
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    CPU_ZERO(&set);
+    for (u32 cpu = 0; cpu < (u32)get_nprocs() && cpu < CPU_SETSIZE; ++cpu) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  TOPO.cpus = 0;
+  for (u32 cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      TOPO.cpu[TOPO.cpus] = cpu;
+      topo_cpu(cpu, TOPO.grp[TOPO.cpus]);
+      TOPO.cpus += 1;
+    }
+  }
+  bool pin = OPTS.pin != PIN_NONE && TOPO.cpus > 0;
+  if (pin) {
+    topo_order(OPTS.pin);
+  }
 
-      Pair got = atomic_exchange_explicit(&net->rbag_buf[idx], 0, memory_order_relaxed);
-      if (got != 0) {
-        push_redex(net, tm, got);
-        continue;
-      } else {
-        tm->sidx = 0;
+  // Places each thread.
+  for (u32 t = 0; t < TPC; ++t) {
+    u32* grp = TOPO.thr[t];
+    if (pin) {
+      TOPO.pin[t] = t % TOPO.cpus;
+      memcpy(grp, TOPO.grp[TOPO.pin[t]], sizeof(TOPO.thr[t]));
+      if (NUMA.nodes > 1) {
+        NUMA.node[t] = grp[STEAL_NODE];
+      }
+      continue;
+    }
+    grp[STEAL_CORE] = CPU_SETSIZE + t;
+    grp[STEAL_CACHE] = CPU_SETSIZE + t;
+    grp[STEAL_NODE] = NUMA.node[t];
+    grp[STEAL_SOCKET] = 0;
+    for (u32 i = 0; i < TOPO.cpus; ++i) {
+      if (TOPO.grp[i][STEAL_NODE] == NUMA.node[t]) {
+        grp[STEAL_SOCKET] = TOPO.grp[i][STEAL_SOCKET];
+        break;
       }
+    }
+  }
 
-      // Chill...
-      sched_yield();
-      // Halt if all threads are idle
-      if (tick % 256 == 0) {
-        if (atomic_load_explicit(&net->idle, memory_order_relaxed) == TPC) {
-          break;
+  // Lists each thread's victims, nearest first.
+  for (u32 t = 0; t < TPC; ++t) {
+    u32 len = 0;
+    for (u32 l = 0; l < STEAL_LEVELS; ++l) {
+      for (u32 v = 0; v < TPC; ++v) {
+        if (v != t && topo_level(t, v) == l) {
+          tm[t]->vics_buf[len++] = v;
         }
       }
+      tm[t]->vend[l] = len;
     }
   }
+}
 
-  sync_threads();
-
-  atomic_fetch_add(&net->itrs, tm->itrs);
-  tm->itrs = 0;
+// Pins the calling thread to its cpu (with --pin), else to its node's cpus.
+void topo_pin(u32 tid) {
+  if (OPTS.pin != PIN_NONE && TOPO.cpus > 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(TOPO.cpu[TOPO.pin[tid]], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  } else if (NUMA.nodes > 1) {
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &NUMA.cpus[NUMA.node[tid]]);
+  }
 }
 
 // Normalizer
@@ -1194,39 +3535,302 @@ typedef struct {
   Book* book;
 } ThreadArg;
 
+// Thread pool: the evaluation threads are spawned once, and park between
+// normalizations. Each normalization bumps `epoch` to wake them, and the last
+// thread to finish wakes the caller. Since IO and readback call normalize in
+// quick succession, both sides spin briefly before parking, unless there are
+// no spare cpus to spin on.
+#define POOL_SPIN (1 << 12)
+
+typedef struct {
+  pthread_t       threads[TPC_MAX];
+  ThreadArg       args[TPC_MAX];
+  pthread_mutex_t lock;
+  pthread_cond_t  wake; // signaled when a normalization starts
+  pthread_cond_t  done; // signaled when the last thread finishes
+  a32             epoch; // normalizations started
+  a32             left; // threads still evaluating
+  u32             spin; // spins before parking
+  bool            live; // threads spawned
+  bool            quit; // threads should exit
+} Pool;
+
+static Pool POOL = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+};
+
 void* thread_func(void* arg) {
   ThreadArg* data = (ThreadArg*)arg;
-  evaluator(data->net, data->tm, data->book);
-  return NULL;
+  topo_pin(data->tm->tid);
+  u32 seen = 0;
+  while (true) {
+    // Waits for the next normalization
+    for (u32 i = 0; i < POOL.spin && atomic_load_explicit(&POOL.epoch, memory_order_relaxed) == seen; ++i);
+    pthread_mutex_lock(&POOL.lock);
+    while (atomic_load_explicit(&POOL.epoch, memory_order_acquire) == seen) {
+      pthread_cond_wait(&POOL.wake, &POOL.lock);
+    }
+    seen = atomic_load_explicit(&POOL.epoch, memory_order_acquire);
+    bool quit = POOL.quit;
+    pthread_mutex_unlock(&POOL.lock);
+    if (quit) {
+      return NULL;
+    }
+
+    evaluator(data->net, data->tm, data->book);
+
+    // Wakes the caller if this was the last thread
+    if (atomic_fetch_sub_explicit(&POOL.left, 1, memory_order_acq_rel) == 1) {
+      pthread_mutex_lock(&POOL.lock);
+      pthread_cond_signal(&POOL.done);
+      pthread_mutex_unlock(&POOL.lock);
+    }
+  }
+}
+
+// Spawns the evaluation threads, if not yet running.
+void pool_start() {
+  if (POOL.live) {
+    return;
+  }
+  POOL.quit = false;
+  POOL.spin = get_nprocs() > TPC ? POOL_SPIN : 0;
+  for (u32 t = 0; t < TPC; ++t) {
+    POOL.args[t].tm = tm[t];
+    pthread_create(&POOL.threads[t], NULL, thread_func, &POOL.args[t]);
+  }
+  POOL.live = true;
+}
+
+// Stops and joins the evaluation threads.
+void pool_stop() {
+  if (!POOL.live) {
+    return;
+  }
+  pthread_mutex_lock(&POOL.lock);
+  POOL.quit = true;
+  atomic_fetch_add_explicit(&POOL.epoch, 1, memory_order_release);
+  pthread_cond_broadcast(&POOL.wake);
+  pthread_mutex_unlock(&POOL.lock);
+  for (u32 t = 0; t < TPC; ++t) {
+    pthread_join(POOL.threads[t], NULL);
+  }
+  atomic_store(&POOL.epoch, 0);
+  POOL.live = false;
 }
 
 // Sets the initial redex.
 void boot_redex(Net* net, Pair redex) {
+  PROBE2(boot_redex, get_fst(redex), get_snd(redex));
   net->vars_buf[get_val(ROOT)] = NONE;
-  net->rbag_buf[0] = redex;
+  push_redex(net, tm[0], redex);
+}
+
+// Adds the statistics `b` to `a`.
+static void stats_add(Stats* a, Stats* b) {
+  u64* x = (u64*)a;
+  u64* y = (u64*)b;
+  for (u32 i = 0; i < sizeof(Stats) / sizeof(u64); ++i) {
+    x[i] += y[i];
+  }
+}
+
+// Prints the evaluator statistics.
+static void stats_print(Net* net) {
+  Stats* st = &net->stat;
+  const char* names[] = {"link", "call", "void", "eras", "anni", "comm", "oper", "swit"};
+  // Compiled calls also reduce some redexes inline, only counted in ITRS
+  u64 inl = atomic_load(&net->itrs);
+  for (u32 r = 0; r < 8; ++r) {
+    inl -= r != LINK ? st->rule[r] : 0;
+  }
+  printf("- RULES:");
+  for (u32 r = 0; r < 8; ++r) {
+    printf(" %s %" PRIu64 ",", names[r], st->rule[r]);
+  }
+  printf(" inlined %" PRIu64 "\n", inl);
+  printf("- FAILS:");
+  for (u32 r = 0; r < 8; ++r) {
+    printf(" %s %" PRIu64 "%s", names[r], st->fail[r], r < 7 ? "," : "\n");
+  }
+  printf("- STEALS: %" PRIu64 " of %" PRIu64 " tries, taking %" PRIu64 " core, %" PRIu64 " cache, %" PRIu64 " node, %" PRIu64 " socket and %" PRIu64 " remote redexes; %" PRIu64 " handed off\n",
+    st->steal_hit, st->steal_try,
+    atomic_load(&net->stls[STEAL_CORE]), atomic_load(&net->stls[STEAL_CACHE]), atomic_load(&net->stls[STEAL_NODE]),
+    atomic_load(&net->stls[STEAL_SOCKET]), atomic_load(&net->stls[STEAL_REMOTE]), atomic_load(&net->give));
+  printf("- CHAINS: %.3f vars per link, %.3f per enter\n",
+    (double)st->link_hops / (st->link ? st->link : 1), (double)st->enter_hops / (st->enter ? st->enter : 1));
+  printf("- PROBES: %.3f per allocation\n", (double)st->probe / (st->alloc ? st->alloc : 1));
+  u64 min = UINT64_MAX, max = 0;
+  for (u32 t = 0; t < TPC; ++t) {
+    min = net->tstat[t] < min ? net->tstat[t] : min;
+    max = net->tstat[t] > max ? net->tstat[t] : max;
+  }
+  printf("- THREADS: %" PRIu32 ", from %" PRIu64 " to %" PRIu64 " interactions each\n", TPC, min, max);
 }
 
 // Evaluates all redexes.
-// TODO: cache threads to avoid spawning overhead
 void normalize(Net* net, Book* book) {
+  PROBE1(normalize_start, TPC);
+  u64 ini = trace_now(TRACE_MAIN);
+  pool_start();
+
   // Inits thread_arg objects
-  ThreadArg thread_arg[TPC];
   for (u32 t = 0; t < TPC; ++t) {
-    thread_arg[t].net  = net;
-    thread_arg[t].tm   = tm[t];
-    thread_arg[t].book = book;
+    POOL.args[t].net  = net;
+    POOL.args[t].book = numa_book(book, t);
   }
 
-  // Spawns the evaluation threads
-  pthread_t threads[TPC];
+  // Wakes the evaluation threads
+  atomic_store_explicit(&POOL.left, TPC, memory_order_relaxed);
+  pthread_mutex_lock(&POOL.lock);
+  atomic_fetch_add_explicit(&POOL.epoch, 1, memory_order_release);
+  pthread_cond_broadcast(&POOL.wake);
+  pthread_mutex_unlock(&POOL.lock);
+
+  // Waits for them to finish
+  for (u32 i = 0; i < POOL.spin && atomic_load_explicit(&POOL.left, memory_order_relaxed) > 0; ++i);
+  pthread_mutex_lock(&POOL.lock);
+  while (atomic_load_explicit(&POOL.left, memory_order_acquire) > 0) {
+    pthread_cond_wait(&POOL.done, &POOL.lock);
+  }
+  pthread_mutex_unlock(&POOL.lock);
+
+  // Sums up the threads' statistics
   for (u32 t = 0; t < TPC; ++t) {
-    pthread_create(&threads[t], NULL, thread_func, &thread_arg[t]);
+    stats_add(&net->stat, &tm[t]->stat);
+    for (u32 r = 0; r < 8; ++r) {
+      net->tstat[t] += tm[t]->stat.rule[r];
+    }
+    memset(&tm[t]->stat, 0, sizeof(Stats));
   }
+  PROBE1(normalize_end, atomic_load(&net->itrs));
+  trace_span(TRACE_MAIN, TRACE_NORM, ini, 0);
+}
+
+// Sampler
+// -------
+
+// With `--sample <ms>`, a thread wakes up every ms milliseconds and writes how
+// the evaluation is going to stderr (or `--sample-file`), one line each:
+//
+//   sample t=2.000 itrs=81234567 mips=40.12 busy=3 idle=1 nodes=1234567 node_slots=4194304 vars_slots=4194304 heap=96M/15360M bags=12:40,0:0,...
+//
+// `mips` is the rate since the previous line, `nodes` the live nodes (as last
+// published by the threads), `*_slots` the committed node and vars locations,
+// and `bags` each thread's local (hbag and mbag) and shared (deque) redexes.
+// The threads' counters are read without synchronizing, so they may be a bit
+// stale.
+
+typedef struct {
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  wake;
+  bool            live; // sampler running
+  bool            quit; // sampler should exit
+  Net*            net;
+  FILE*           file; // where lines go
+  u64             start; // time of the first sample, in ns
+} Sampler;
+
+static Sampler SAMPLER = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+};
+
+// Reads a counter another thread writes.
+static inline u32 sample_u32(u32* ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static inline Loc sample_loc(Loc* ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
 
-  // Wait for the threads to finish
+// Writes one sample line. `last` holds the previous interaction count and time.
+static void sample_write(Net* net, FILE* file, u64* last_itrs, u64* last_time) {
+  u64 now  = time64();
+  u64 itrs = atomic_load_explicit(&net->itrs, memory_order_relaxed);
+  u64 nlim = 0, vlim = 0;
+  for (u32 t = 0; t < TPC; ++t) {
+    itrs += sample_u32(&tm[t]->itrs);
+    nlim += sample_loc(&tm[t]->nlim);
+    vlim += sample_loc(&tm[t]->vlim);
+  }
+  // Threads publish their counts as they finish, so this may briefly dip
+  itrs = itrs > *last_itrs ? itrs : *last_itrs;
+  u32 idle = atomic_load_explicit(&net->idle, memory_order_relaxed);
+  idle = idle < TPC ? idle : TPC;
+  fprintf(file, "sample t=%.3f itrs=%" PRIu64 " mips=%.2f busy=%" PRIu32 " idle=%" PRIu32 " nodes=%" PRIi64 " node_slots=%" PRIu64 " vars_slots=%" PRIu64 " heap=%" PRIu64 "M/%" PRIu64 "M bags=",
+    (now - SAMPLER.start) / 1e9, itrs, (double)(itrs - *last_itrs) / ((now - *last_time) / 1e3 + 1),
+    TPC - idle, idle, (i64)atomic_load_explicit(&net->nodes, memory_order_relaxed), nlim, vlim,
+    atomic_load_explicit(&net->heap_len, memory_order_relaxed) >> 20, net->heap_max >> 20);
   for (u32 t = 0; t < TPC; ++t) {
-    pthread_join(threads[t], NULL);
+    u32 local = sample_u32(&tm[t]->hput) + sample_u32(&tm[t]->mput);
+    fprintf(file, "%" PRIu32 ":%" PRIu32 "%s", local, deque_len(net, t), t + 1 < TPC ? "," : "\n");
+  }
+  fflush(file);
+  *last_itrs = itrs;
+  *last_time = now;
+}
+
+void* sampler_func(void* arg) {
+  u64 last_itrs = 0;
+  u64 last_time = SAMPLER.start;
+  pthread_mutex_lock(&SAMPLER.lock);
+  while (true) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    u64 ns = (u64)ts.tv_nsec + OPTS.sample * 1000000;
+    ts.tv_sec  += ns / 1000000000;
+    ts.tv_nsec  = ns % 1000000000;
+    while (!SAMPLER.quit && pthread_cond_timedwait(&SAMPLER.wake, &SAMPLER.lock, &ts) == 0);
+    if (SAMPLER.quit) {
+      break;
+    }
+    pthread_mutex_unlock(&SAMPLER.lock);
+    sample_write(SAMPLER.net, SAMPLER.file, &last_itrs, &last_time);
+    pthread_mutex_lock(&SAMPLER.lock);
+  }
+  pthread_mutex_unlock(&SAMPLER.lock);
+  return NULL;
+}
+
+// Starts the sampler, if enabled.
+void sampler_start(Net* net) {
+  if (OPTS.sample == 0) {
+    return;
+  }
+  FILE* file = stderr;
+  if (OPTS.sample_file && (file = fopen(OPTS.sample_file, "w")) == NULL) {
+    fprintf(stderr, "failed to open %s, sampling to stderr\n", OPTS.sample_file);
+    file = stderr;
+  }
+  SAMPLER.net   = net;
+  SAMPLER.file  = file;
+  SAMPLER.start = time64();
+  SAMPLER.quit  = false;
+  SAMPLER.live  = pthread_create(&SAMPLER.thread, NULL, sampler_func, NULL) == 0;
+  if (!SAMPLER.live && file != stderr) {
+    fclose(file);
+  }
+}
+
+// Stops the sampler, if running.
+void sampler_stop() {
+  if (!SAMPLER.live) {
+    return;
   }
+  pthread_mutex_lock(&SAMPLER.lock);
+  SAMPLER.quit = true;
+  pthread_cond_signal(&SAMPLER.wake);
+  pthread_mutex_unlock(&SAMPLER.lock);
+  pthread_join(SAMPLER.thread, NULL);
+  if (SAMPLER.file != stderr) {
+    fclose(SAMPLER.file);
+  }
+  SAMPLER.live = false;
 }
 
 // Util: expands a REF Port.
@@ -1257,7 +3861,7 @@ void read_img(Net* net, Port port, u32 width, u32 height, u32* buffer) {
   stk[pos++] = (Rect){port, 0, 0, width, 0, height};
   while (pos > 0) {
     Rect rect = stk[--pos];
-    Port port = enter(net, rect.port);
+    Port port = enter(net, tm[0], rect.port);
     u32  lv   = rect.lv;
     u32  x0   = rect.x0;
     u32  x1   = rect.x1;
@@ -1402,58 +4006,354 @@ void read_img(Net* net, Port port, u32 width, u32 height, u32* buffer) {
 //}
 //#endif
 
-// Book Loader
-// -----------
+// Compaction
+// ----------
 
-bool book_load(Book* book, u32* buf) {
-  // Reads defs_len
-  book->defs_len = *buf++;
+// Between normalizations (e.g., IO steps), the net is only reachable from
+// ROOT, but it may be scattered over the heap. Compaction copies it out in
+// depth-first order, resolving substitutions and dropping garbage, then
+// writes it back densely at the start of the thread slices, spread evenly.
 
-  // Parses each def
-  for (u32 i = 0; i < book->defs_len; ++i) {
-    // Reads fid
-    u32 fid = *buf++;
+// Growable buffer of u32s or Pairs.
+static void* comp_grow(void* buf, u64* cap, u64 len, u64 size) {
+  if (len < *cap) {
+    return buf;
+  }
+  *cap = *cap ? *cap * 2 : 1 << 16;
+  void* got = realloc(buf, *cap * size);
+  if (got == NULL) {
+    fprintf(stderr, "HVM: out of memory while compacting\n");
+    exit(1);
+  }
+  return got;
+}
 
-    // Gets def
-    Def* def = &book->defs_buf[fid];
+// Compaction state. Nodes and vars are numbered in the order they're found.
+typedef struct {
+  Net*  net;
+  Loc*  vmap; // old var -> new var + 1 (sparse)
+  Pair* node; // new node -> contents
+  Loc*  todo; // new nodes with ports left to move
+  Port* vars; // new var -> contents
+  u64   node_len, node_cap;
+  u64   todo_len, todo_cap;
+  u64   vars_len, vars_cap;
+} Comp;
+
+// Moves a port, numbering the node or var it points to.
+static Port comp_port(Comp* c, Port port) {
+  // Resolves substitutions
+  while (is_var(port) && port != ROOT) {
+    Port val = vars_load(c->net, get_val(port));
+    if (val == 0 || val == NONE) break;
+    port = val;
+  }
+  if (is_var(port) && port != ROOT) {
+    Loc old = get_val(port);
+    if (c->vmap[old] == 0) {
+      c->vars = comp_grow(c->vars, &c->vars_cap, c->vars_len, sizeof(Port));
+      c->vars[c->vars_len] = vars_load(c->net, old);
+      c->vmap[old] = ++c->vars_len;
+    }
+    return new_port(VAR, c->vmap[old] - 1);
+  }
+  if (is_nod(port)) {
+    c->node = comp_grow(c->node, &c->node_cap, c->node_len, sizeof(Pair));
+    c->todo = comp_grow(c->todo, &c->todo_cap, c->todo_len, sizeof(Loc));
+    c->node[c->node_len] = node_load(c->net, get_val(port));
+    c->todo[c->todo_len++] = c->node_len;
+    return new_port(get_tag(port), c->node_len++);
+  }
+  return port;
+}
 
-    // Reads name
-    memcpy(def->name, buf, 256);
-    buf += 64;
+// Spreads `len` locations over the thread slices, filling at most `lim` of
+// each, from `ini`. Fills `loc` with the global location of each, and `put`
+// with how many each slice got.
+static void comp_place(Loc* loc, u64 len, u64 slice, Loc* ini, Loc* lim, Loc* put) {
+  u64 rem = len;
+  u64 idx = 0;
+  for (u32 t = 0; t < TPC; ++t) {
+    put[t] = 0;
+  }
+  for (u32 pass = 0; pass < 2 && rem > 0; ++pass) {
+    for (u32 t = 0; t < TPC && rem > 0; ++t) {
+      u64 cap = lim[t] - ini[t] - put[t];
+      u64 num = min64(cap, pass == 0 ? min64(rem, (len + TPC - 1) / TPC) : rem);
+      for (u64 i = 0; i < num; ++i) {
+        loc[idx++] = t * slice + ini[t] + put[t] + i;
+      }
+      put[t] += num;
+      rem -= num;
+    }
+  }
+}
 
-    // Reads safe flag
-    def->safe = *buf++;
+// Zeroes part of the heap, giving whole pages back to the OS.
+static void heap_clear(Net* net, void* ptr, u64 len) {
+  u64 align = net->huge ? HUGE_ALIGN : PAGE_ALIGN;
+  u8* ini = (u8*)ptr;
+  u8* fin = ini + len;
+  u8* pag_ini = (u8*)(((uintptr_t)ini + align - 1) & ~(align - 1));
+  u8* pag_fin = (u8*)((uintptr_t)fin & ~(align - 1));
+  if (pag_ini < pag_fin && madvise(pag_ini, pag_fin - pag_ini, MADV_DONTNEED) == 0) {
+    memset(ini, 0, pag_ini - ini);
+    memset(pag_fin, 0, fin - pag_fin);
+  } else {
+    memset(ini, 0, len);
+  }
+}
 
-    // Reads lengths
-    def->rbag_len = *buf++;
-    def->node_len = *buf++;
-    def->vars_len = *buf++;
+// True if the heap spans enough more nodes than were live after the last
+// compaction that it is worth compacting.
+bool net_fragmented(Net* net) {
+  u64 span = 0;
+  for (u32 t = 0; t < TPC; ++t) {
+    span += tm[t]->nput;
+  }
+  return OPTS.compact > 0 && span >= OPTS.compact * (net->live > HEAP_CHUNK ? net->live : HEAP_CHUNK);
+}
 
-    if (def->rbag_len > DEF_RBAG_LEN) {
-      fprintf(stderr, "def '%s' has too many redexes: %u\n", def->name, def->rbag_len);
-      return false;
+// Compacts the net reachable from ROOT. Must run with no redexes pending.
+void net_compact(Net* net) {
+  Comp c = {0};
+  c.net  = net;
+  c.vmap = mmap(NULL, G_VARS_LEN * sizeof(Loc), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (c.vmap == MAP_FAILED) {
+    return;
+  }
+
+  // Copies the net out, numbering nodes and vars in depth-first order
+  Port root = comp_port(&c, vars_load(net, get_val(ROOT)));
+  while (c.todo_len > 0) {
+    Loc  idx  = c.todo[--c.todo_len];
+    Pair node = c.node[idx];
+    Port fst  = comp_port(&c, get_fst(node));
+    Port snd  = comp_port(&c, get_snd(node));
+    c.node[idx] = new_pair(fst, snd);
+  }
+  munmap(c.vmap, G_VARS_LEN * sizeof(Loc));
+
+  // Places nodes and vars in the committed thread slices. Location 0 and the
+  // ROOT var are never used.
+  Loc node_ini[TPC_MAX], node_lim[TPC_MAX], node_put[TPC_MAX];
+  Loc vars_ini[TPC_MAX], vars_lim[TPC_MAX], vars_put[TPC_MAX];
+  for (u32 t = 0; t < TPC; ++t) {
+    Loc root_off = get_val(ROOT) - t*VARS_SLICE;
+    node_ini[t] = t == 0 ? 1 : 0;
+    vars_ini[t] = t == 0 ? 1 : 0;
+    node_lim[t] = tm[t]->nlim;
+    vars_lim[t] = root_off < tm[t]->vlim ? root_off : tm[t]->vlim;
+    node_lim[t] = node_lim[t] < node_ini[t] ? node_ini[t] : node_lim[t];
+    vars_lim[t] = vars_lim[t] < vars_ini[t] ? vars_ini[t] : vars_lim[t];
+  }
+  Loc* node_loc = malloc(c.node_len * sizeof(Loc) + 1);
+  Loc* vars_loc = malloc(c.vars_len * sizeof(Loc) + 1);
+  if (node_loc == NULL || vars_loc == NULL) {
+    fprintf(stderr, "HVM: out of memory while compacting\n");
+    exit(1);
+  }
+  comp_place(node_loc, c.node_len, NODE_SLICE, node_ini, node_lim, node_put);
+  comp_place(vars_loc, c.vars_len, VARS_SLICE, vars_ini, vars_lim, vars_put);
+
+  // Clears the used part of each slice
+  for (u32 t = 0; t < TPC; ++t) {
+    heap_clear(net, &net->node_buf[t*NODE_SLICE], tm[t]->nput * sizeof(ANode));
+    heap_clear(net, &net->vars_buf[t*VARS_SLICE], tm[t]->vput * sizeof(APort));
+  }
+
+  // Writes the net back, pointing ports to the new locations
+  for (u64 i = 0; i < c.node_len; ++i) {
+    Port ports[2] = {get_fst(c.node[i]), get_snd(c.node[i])};
+    for (u32 k = 0; k < 2; ++k) {
+      if (is_nod(ports[k])) {
+        ports[k] = new_port(get_tag(ports[k]), node_loc[get_val(ports[k])]);
+      } else if (is_var(ports[k]) && ports[k] != ROOT) {
+        ports[k] = new_port(VAR, vars_loc[get_val(ports[k])]);
+      }
     }
+    node_create(net, node_loc[i], new_pair(ports[0], ports[1]));
+  }
+  for (u64 i = 0; i < c.vars_len; ++i) {
+    vars_create(net, vars_loc[i], c.vars[i]);
+  }
+  if (is_nod(root)) {
+    root = new_port(get_tag(root), node_loc[get_val(root)]);
+  } else if (is_var(root) && root != ROOT) {
+    root = new_port(VAR, vars_loc[get_val(root)]);
+  }
+  vars_create(net, get_val(ROOT), root);
+
+  // Resets the allocators past the placed locations
+  for (u32 t = 0; t < TPC; ++t) {
+    tm[t]->nput = node_ini[t] + node_put[t];
+    tm[t]->vput = vars_ini[t] + vars_put[t];
+    tm[t]->nswp = 0;
+    tm[t]->vswp = 0;
+    tm[t]->nfre = 0;
+    tm[t]->vfre = 0;
+  }
+
+  debug("compacted: %" PRIu64 " nodes, %" PRIu64 " vars\n", c.node_len, c.vars_len);
+  net->live = c.node_len;
+  atomic_store(&net->nodes, c.node_len);
+  for (u32 t = 0; t < TPC; ++t) {
+    tm[t]->nliv = 0;
+  }
+  sched_update(net, tm[0]);
+
+  free(node_loc);
+  free(vars_loc);
+  free(c.node);
+  free(c.todo);
+  free(c.vars);
+}
+
+// Book Loader
+// -----------
+
+// The buffer starts with defs_len and the port size (1 or 2 words). Then, each
+// def is: fid, name (64 words), safe, rbag_len, node_len, vars_len, and ports:
+// the root, then its redexes and nodes (2 ports each).
+#define DEF_HEAD_LEN 69
+
+// Reads the port at ptr, of the given size.
+static inline Port book_port(u32* ptr, u32 port_len) {
+  #ifdef HVM64
+  if (port_len == 2) {
+    Port port;
+    memcpy(&port, ptr, sizeof(Port));
+    return port;
+  }
+  #endif
+  return port_load(ptr[0]);
+}
+
+// Loads a book from a buffer. Returns success.
+bool book_load(Book* book, u32* buf) {
+  // Reads defs_len and the port size
+  u32 defs_len = *buf++;
+  u32 port_len = *buf++;
+  memset(book, 0, sizeof(Book));
+  book->defs_len = defs_len;
+  if (port_len * sizeof(u32) > sizeof(Port)) {
+    fprintf(stderr, "the book has 64-bit ports, which need a runtime built with -DHVM64\n");
+    return false;
+  }
 
-    if (def->node_len > DEF_NODE_LEN) {
-      fprintf(stderr, "def '%s' has too many nodes: %u\n", def->name, def->node_len);
+  // Finds each def, and measures the packed defs and names
+  u32** defs = calloc(defs_len, sizeof(u32*));
+  u64 defs_size = 0;
+  u64 name_size = 0;
+  for (u32 i = 0; i < defs_len; ++i) {
+    u32 fid = buf[0];
+    if (fid >= defs_len || defs[fid] != NULL) {
+      fprintf(stderr, "invalid def id: %u\n", fid);
+      free(defs);
       return false;
     }
+    defs[fid] = buf;
+    char* name = (char*)&buf[1];
+    u32 rbag_len = buf[66];
+    u32 node_len = buf[67];
+    u32 vars_len = buf[68];
+    LOC_LEN = node_len > LOC_LEN ? node_len : LOC_LEN;
+    LOC_LEN = vars_len > LOC_LEN ? vars_len : LOC_LEN;
+    defs_size += def_size(rbag_len, node_len);
+    name_size += strnlen(name, 256) + 1;
+    buf += DEF_HEAD_LEN + (1 + (rbag_len + node_len) * 2) * port_len;
+  }
 
-    // Reads root
-    def->root = *buf++;
+  // Orders the defs depth-first from main, then the unreachable ones
+  u32* order = malloc(defs_len * sizeof(u32));
+  u32* stack = malloc(defs_len * sizeof(u32));
+  bool* seen = calloc(defs_len, sizeof(bool));
+  u32 order_len = 0;
+  u32 stack_len = 0;
+  for (u32 fid = 0; fid < defs_len; ++fid) {
+    if (seen[fid]) {
+      continue;
+    }
+    seen[fid] = true;
+    stack[stack_len++] = fid;
+    while (stack_len > 0) {
+      u32* def = defs[stack[--stack_len]];
+      order[order_len++] = def[0];
+      u32* ports = &def[DEF_HEAD_LEN];
+      u32 ports_len = 1 + (def[66] + def[67]) * 2;
+      for (u32 k = ports_len; k-- > 0;) {
+        Port port = book_port(&ports[k * port_len], port_len);
+        Val  ref  = get_val(port) & 0xFFFFFFF; // drops the par flag
+        if (get_tag(port) == REF && ref < defs_len && !seen[ref]) {
+          seen[ref] = true;
+          stack[stack_len++] = ref;
+        }
+      }
+    }
+  }
 
-    // Reads rbag_buf
-    memcpy(def->rbag_buf, buf, 8*def->rbag_len);
-    buf += def->rbag_len * 2;
+  // Packs the defs and names
+  book->defs_off  = malloc(defs_len * sizeof(u64));
+  book->defs_buf  = malloc(defs_size);
+  book->defs_size = defs_size;
+  book->name_buf  = malloc(name_size);
+  u64 defs_put = 0;
+  u32 name_put = 0;
+  for (u32 i = 0; i < order_len; ++i) {
+    u32* src = defs[order[i]];
+    Def* def = (Def*)(book->defs_buf + defs_put);
+    book->defs_off[src[0]] = defs_put;
 
-    // Reads node_buf
-    memcpy(def->node_buf, buf, 8*def->node_len);
-    buf += def->node_len * 2;
+    // Reads name
+    char* name = (char*)&src[1];
+    u32   len  = strnlen(name, 256);
+    memcpy(&book->name_buf[name_put], name, len);
+    book->name_buf[name_put + len] = '\0';
+    def->name = name_put;
+    name_put += len + 1;
+
+    // Reads safe flag, lengths and root
+    def->safe     = src[65];
+    def->rbag_len = src[66];
+    def->node_len = src[67];
+    def->vars_len = src[68];
+    def->root     = book_port(&src[DEF_HEAD_LEN], port_len);
+
+    // Reads rbag_buf and node_buf, which are contiguous
+    u32* data = &src[DEF_HEAD_LEN + port_len];
+    for (u32 k = 0; k < def->rbag_len + def->node_len; ++k) {
+      Port fst = book_port(&data[(k*2+0) * port_len], port_len);
+      Port snd = book_port(&data[(k*2+1) * port_len], port_len);
+      def->data[k] = new_pair(fst, snd);
+    }
+    defs_put += def_size(def->rbag_len, def->node_len);
   }
 
+  free(defs);
+  free(order);
+  free(stack);
+  free(seen);
+
   return true;
 }
 
+// Frees a book's buffers.
+void book_free(Book* book) {
+  free(book->defs_off);
+  free(book->defs_buf);
+  free(book->name_buf);
+  free(book->ffns_buf);
+}
+
+// Adds a foreign function to a book.
+void book_add_ffn(Book* book, const char* name, Port (*func)(Net*, Book*, Port)) {
+  if (book->ffns_len == book->ffns_cap) {
+    book->ffns_cap = book->ffns_cap ? book->ffns_cap * 2 : 16;
+    book->ffns_buf = realloc(book->ffns_buf, book->ffns_cap * sizeof(FFn));
+  }
+  book->ffns_buf[book->ffns_len++] = (FFn){name, func};
+}
+
 // Debug Printing
 // --------------
 
@@ -1514,19 +4414,23 @@ Show show_rule(Rule rule) {
 void print_net(Net* net) {
   printf("NODE | PORT-1       | PORT-2      \n");
   printf("---- | ------------ | ------------\n");
-  for (u32 i = 0; i < G_NODE_LEN; ++i) {
-    Pair node = node_load(net, i);
-    if (node != 0) {
-      printf("%04X | %s | %s\n", i, show_port(get_fst(node)).x, show_port(get_snd(node)).x);
+  for (u32 t = 0; t < TPC; ++t) {
+    for (Loc i = t*NODE_SLICE; i < t*NODE_SLICE + tm[t]->nlim; ++i) {
+      Pair node = node_load(net, i);
+      if (node != 0) {
+        printf("%04" PRIX64 " | %s | %s\n", (u64)i, show_port(get_fst(node)).x, show_port(get_snd(node)).x);
+      }
     }
   }
   printf("==== | ============ |\n");
   printf("VARS | VALUE        |\n");
   printf("---- | ------------ |\n");
-  for (u32 i = 0; i < G_VARS_LEN; ++i) {
-    Port var = vars_load(net,i);
-    if (var != 0) {
-      printf("%04X | %s |\n", i, show_port(vars_load(net,i)).x);
+  for (u32 t = 0; t < TPC; ++t) {
+    for (Loc i = t*VARS_SLICE; i < t*VARS_SLICE + tm[t]->vlim; ++i) {
+      Port var = vars_load(net,i);
+      if (var != 0) {
+        printf("%04" PRIX64 " | %s |\n", (u64)i, show_port(vars_load(net,i)).x);
+      }
     }
   }
   printf("==== | ============ |\n");
@@ -1565,11 +4469,11 @@ void pretty_print_numb(Numb word) {
       break;
     }
     case TY_U24: {
-      printf("%u", get_u24(word));
+      printf("%" PRIu64, (u64)get_u24(word));
       break;
     }
     case TY_I24: {
-      printf("%+d", get_i24(word));
+      printf("%+" PRId64, (i64)get_i24(word));
       break;
     }
     case TY_F24: {
@@ -1582,32 +4486,36 @@ void pretty_print_numb(Numb word) {
       } else if (isnan(get_f24(word))) {
         printf("+NaN");
       } else {
+        #ifdef HVM64
+        printf("%.8e", get_f24(word)); // a full f32 needs 9 digits
+        #else
         printf("%.7e", get_f24(word));
+        #endif
       }
       break;
     }
     default: {
       switch (get_typ(word)) {
-        case OP_ADD: printf("[+0x%07X]", get_u24(word)); break;
-        case OP_SUB: printf("[-0x%07X]", get_u24(word)); break;
-        case FP_SUB: printf("[:-0x%07X]", get_u24(word)); break;
-        case OP_MUL: printf("[*0x%07X]", get_u24(word)); break;
-        case OP_DIV: printf("[/0x%07X]", get_u24(word)); break;
-        case FP_DIV: printf("[:/0x%07X]", get_u24(word)); break;
-        case OP_REM: printf("[%%0x%07X]", get_u24(word)); break;
-        case FP_REM: printf("[:%%0x%07X]", get_u24(word)); break;
-        case OP_EQ:  printf("[=0x%07X]", get_u24(word)); break;
-        case OP_NEQ: printf("[!0x%07X]", get_u24(word)); break;
-        case OP_LT:  printf("[<0x%07X]", get_u24(word)); break;
-        case OP_GT:  printf("[>0x%07X]", get_u24(word)); break;
-        case OP_AND: printf("[&0x%07X]", get_u24(word)); break;
-        case OP_OR:  printf("[|0x%07X]", get_u24(word)); break;
-        case OP_XOR: printf("[^0x%07X]", get_u24(word)); break;
-        case OP_SHL: printf("[<<0x%07X]", get_u24(word)); break;
-        case FP_SHL: printf("[:<<0x%07X]", get_u24(word)); break;
-        case OP_SHR: printf("[>>0x%07X]", get_u24(word)); break;
-        case FP_SHR: printf("[:>>0x%07X]", get_u24(word)); break;
-        default:     printf("[?0x%07X]", get_u24(word)); break;
+        case OP_ADD: printf("[+0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_SUB: printf("[-0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case FP_SUB: printf("[:-0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_MUL: printf("[*0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_DIV: printf("[/0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case FP_DIV: printf("[:/0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_REM: printf("[%%0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case FP_REM: printf("[:%%0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_EQ:  printf("[=0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_NEQ: printf("[!0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_LT:  printf("[<0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_GT:  printf("[>0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_AND: printf("[&0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_OR:  printf("[|0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_XOR: printf("[^0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_SHL: printf("[<<0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case FP_SHL: printf("[:<<0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case OP_SHR: printf("[>>0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        case FP_SHR: printf("[:>>0x%07" PRIX64 "]", (u64)get_u24(word)); break;
+        default:     printf("[?0x%07" PRIX64 "]", (u64)get_u24(word)); break;
       }
       break;
     }
@@ -1615,6 +4523,22 @@ void pretty_print_numb(Numb word) {
 
 }
 
+#ifdef HVM64
+// Set when a number that doesn't fit the 24-bit types is printed, so 32-bit
+// builds would have printed something else.
+static bool NUMB_WIDE = false;
+
+// True if a number means the same in 32-bit builds.
+static inline bool numb_narrow(Numb word) {
+  switch (get_typ(word)) {
+    case TY_U24: return get_u24(word) <= 0xFFFFFF;
+    case TY_I24: return get_i24(word) >= -0x800000 && get_i24(word) < 0x800000;
+    case TY_F24: return ((word >> 5) & 0xFF) == 0 || isnan(get_f24(word));
+    default:     return true;
+  }
+}
+#endif
+
 void pretty_print_port(Net* net, Book* book, Port port) {
   Port stack[4096];
   stack[0] = port;
@@ -1647,11 +4571,14 @@ void pretty_print_port(Net* net, Book* book, Port port) {
         if (got != NONE) {
           stack[len++] = got;
         } else {
-          printf("x%x", get_val(cur));
+          printf("x%" PRIx64, (u64)get_val(cur));
         }
         break;
       }
       case NUM: {
+        #ifdef HVM64
+        NUMB_WIDE |= !numb_narrow(get_val(cur));
+        #endif
         pretty_print_numb(get_val(cur));
         break;
       }
@@ -1690,8 +4617,8 @@ void pretty_print_port(Net* net, Book* book, Port port) {
       }
       case REF: {
         u32  fid = get_val(cur) & 0xFFFFFFF;
-        Def* def = &book->defs_buf[fid];
-        printf("@%s", def->name);
+        Def* def = book_def(book, fid);
+        printf("@%s", &book->name_buf[def->name]);
         break;
       }
     }
@@ -1740,12 +4667,34 @@ void do_run_io(Net* net, Book* book, Port port);
 // Main
 // ----
 
-void hvm_c(u32* book_buffer) {
-  // Creates static TMs
-  alloc_static_tms();
+// Prints the run report as JSON, on one line of stderr, so it doesn't mix with
+// the program's output. Times are in seconds; peaks per thread are locations of
+// its heap slice and redexes in its bags.
+static void report_json(Net* net, u64 itrs, double time, double cpu, double load) {
+  fprintf(stderr, "{\"itrs\": %" PRIu64 ", \"time\": %.6f, \"cpu_time\": %.6f, \"mips\": %.2f, \"threads\": %" PRIu32,
+    itrs, time, cpu, (double)itrs / time / 1000000.0, TPC);
+  fprintf(stderr, ", \"book_load_time\": %.6f, \"io_time\": %.6f", load, net->io_time / 1e9);
+  fprintf(stderr, ", \"peak_nodes\": %" PRIu64 ", \"peak_heap\": %" PRIu64 ", \"heap_max\": %" PRIu64,
+    atomic_load(&net->peak), atomic_load(&net->heap_peak), net->heap_max);
+  fprintf(stderr, ", \"per_thread\": [");
+  for (u32 t = 0; t < TPC; ++t) {
+    fprintf(stderr, "%s{\"nodes\": %" PRIu64 ", \"vars\": %" PRIu64 ", \"hbag\": %" PRIu32 ", \"rbag\": %" PRIu32 "}",
+      t > 0 ? ", " : "", (u64)tm[t]->nmax, (u64)tm[t]->vmax, tm[t]->hmax, tm[t]->rmax > tm[t]->hmax ? tm[t]->rmax : tm[t]->hmax);
+  }
+  fprintf(stderr, "]}\n");
+}
+
+// Returns the cpu time used by the process, in seconds.
+static double cpu_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
+void hvm_c(u32* book_buffer) {
   // Loads the Book
   Book* book = NULL;
+  u64 load = time64();
   if (book_buffer) {
     book = (Book*)malloc(sizeof(Book));
     if (!book_load(book, book_buffer)) {
@@ -1754,12 +4703,42 @@ void hvm_c(u32* book_buffer) {
       return;
     }
   }
+  load = time64() - load;
+
+  // Picks the thread count
+  tpc_init();
+
+  // Creates static TMs
+  alloc_static_tms();
+  if (OPTS.trace && !trace_init()) {
+    fprintf(stderr, "failed to start the tracer\n");
+    free(OPTS.trace);
+    OPTS.trace = NULL;
+  }
+  if (OPTS.profile && (book == NULL || !prof_init(book))) {
+    fprintf(stderr, "failed to start the profiler\n");
+    free(OPTS.profile);
+    OPTS.profile = NULL;
+  }
+
+  // Reads the NUMA and cpu topology
+  numa_init();
+  topo_init();
 
   // GMem
   Net *net = net_new();
+  if (net == NULL) {
+    return;
+  }
+  numa_bind_net(net);
+
+  // Spawns the evaluation threads
+  pool_start();
 
   // Starts the timer
   u64 start = time64();
+  double cpu = cpu_time();
+  sampler_start(net);
 
   // Creates an initial redex that calls main
   boot_redex(net, new_pair(new_port(REF, 0), ROOT));
@@ -1769,29 +4748,57 @@ void hvm_c(u32* book_buffer) {
   #else
   normalize(net, book);
   #endif
+  sampler_stop();
 
   // Prints the result
   printf("Result: ");
-  pretty_print_port(net, book, enter(net, ROOT));
+  pretty_print_port(net, book, enter(net, tm[0], ROOT));
   printf("\n");
+  #ifdef HVM64
+  if (NUMB_WIDE) {
+    fprintf(stderr, "HVM: the result has numbers wider than u24/i24/f24, which 32-bit builds would have wrapped or rounded\n");
+  }
+  #endif
 
   // Stops the timer
   double duration = (time64() - start) / 1000000000.0; // seconds
 
   // Prints interactions and time
   u64 itrs = atomic_load(&net->itrs);
-  printf("- ITRS: %" PRIu64 "\n", itrs);
-  printf("- TIME: %.2fs\n", duration);
-  printf("- MIPS: %.2f\n", (double)itrs / duration / 1000000.0);
+  if (OPTS.report == REPORT_JSON) {
+    report_json(net, itrs, duration, cpu_time() - cpu, load / 1e9);
+  } else {
+    printf("- ITRS: %" PRIu64 "\n", itrs);
+    printf("- TIME: %.2fs\n", duration);
+    printf("- MIPS: %.2f\n", (double)itrs / duration / 1000000.0);
+  }
+  if (OPTS.stats) {
+    stats_print(net);
+  }
+  if (OPTS.profile && !prof_report(book)) {
+    fprintf(stderr, "failed to write the profile to %s\n", OPTS.profile);
+  }
+  if (OPTS.trace && !trace_write(book)) {
+    fprintf(stderr, "failed to write the trace to %s\n", OPTS.trace);
+  }
 
   // Frees everything
+  pool_stop();
+  numa_free_books();
   free_static_tms();
-  free(net);
+  trace_free();
+  net_free(net);
+  if (book) {
+    book_free(book);
+  }
   free(book);
 }
 
 #ifdef WITH_MAIN
-int main() {
+int main(int argc, char** argv) {
+  if (!hvm_c_args(argc, argv)) {
+    return 1;
+  }
   hvm_c((u32*)BOOK_BUF);
   return 0;
 }
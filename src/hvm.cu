@@ -1899,6 +1899,12 @@ bool book_load(Book* book, u32* buf) {
   // Reads defs_len
   book->defs_len = *buf++;
 
+  // Reads the port size, in words (CUDA only has 32-bit ports)
+  if (*buf++ != 1) {
+    fprintf(stderr, "the book has 64-bit ports, which the CUDA runtime doesn't support\n");
+    return false;
+  }
+
   // Parses each def
   for (u32 i = 0; i < book->defs_len; ++i) {
     // Reads fid
@@ -4,6 +4,10 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+
+// Libraries loaded by an HVM64 runtime (built with `--features hvm64`,
+// `gen-c --hvm64` or -DHVM64) must be built with -DHVM64 too.
 
 // Types
 // -----
@@ -13,17 +17,37 @@ typedef uint16_t u16;
 typedef uint32_t u32;
 typedef  int32_t i32;
 typedef uint64_t u64;
+typedef  int64_t i64;
+typedef unsigned __int128 u128;
 typedef    float f32;
 typedef   double f64;
 
 // Local Types
+#ifdef HVM64
+typedef u8   Tag;  // Tag  ::= 3-bit (rounded up to u8)
+typedef u64  Val;  // Val  ::= 61-bit (rounded up to u64)
+typedef u64  Port; // Port ::= Tag + Val (fits a u64)
+typedef u128 Pair; // Pair ::= Port + Port (fits a u128)
+#else
 typedef u8  Tag;  // Tag  ::= 3-bit (rounded up to u8)
 typedef u32 Val;  // Val  ::= 29-bit (rounded up to u32)
 typedef u32 Port; // Port ::= Tag + Val (fits a u32)
 typedef u64 Pair; // Pair ::= Port + Port (fits a u64)
+#endif
 
 // Numbs
+// With HVM64, the u24/i24 types hold 56-bit integers, and f24 a full f32.
+#ifdef HVM64
+typedef u64 Numb; // Numb ::= 61-bit (rounded up to u64)
+typedef u64 UNum; // unsigned payload
+typedef i64 INum; // signed payload
+#define NUMB_BITS 56
+#else
 typedef u32 Numb; // Numb ::= 29-bit (rounded up to u32)
+typedef u32 UNum; // unsigned payload
+typedef i32 INum; // signed payload
+#define NUMB_BITS 24
+#endif
 
 // Tags
 #define VAR 0x0 // variable
@@ -36,10 +60,10 @@ typedef u32 Numb; // Numb ::= 29-bit (rounded up to u32)
 #define SWI 0x7 // switch
 
 // Numbers
-static const f32 U24_MAX = (f32) (1 << 24) - 1;
+static const f32 U24_MAX = (f32) ((1ull << NUMB_BITS) - 1);
 static const f32 U24_MIN = 0.0;
-static const f32 I24_MAX = (f32) (1 << 23) - 1;
-static const f32 I24_MIN = (f32) (i32) ((-1u) << 23);
+static const f32 I24_MAX = (f32) ((1ull << (NUMB_BITS - 1)) - 1);
+static const f32 I24_MIN = (f32) (i64) ((-1ull) << (NUMB_BITS - 1));
 #define TY_SYM 0x00
 #define TY_U24 0x01
 #define TY_I24 0x02
@@ -98,16 +122,18 @@ static inline Val get_val(Port port) {
 // Pair: Constructor and Getters
 // -----------------------------
 
+#define PORT_BITS (sizeof(Port) * 8)
+
 static inline const Pair new_pair(Port fst, Port snd) {
-  return ((u64)snd << 32) | fst;
+  return ((Pair)snd << PORT_BITS) | fst;
 }
 
 static inline Port get_fst(Pair pair) {
-  return pair & 0xFFFFFFFF;
+  return (Port)pair;
 }
 
 static inline Port get_snd(Pair pair) {
-  return pair >> 32;
+  return pair >> PORT_BITS;
 }
 
 // Utils
@@ -132,7 +158,7 @@ static inline f32 clamp(f32 x, f32 min, f32 max) {
 
 // Constructor and getters for SYM (operation selector)
 static inline Numb new_sym(u32 val) {
-  return (val << 5) | TY_SYM;
+  return ((Numb)val << 5) | TY_SYM;
 }
 
 static inline u32 get_sym(Numb word) {
@@ -140,23 +166,38 @@ static inline u32 get_sym(Numb word) {
 }
 
 // Constructor and getters for U24 (unsigned 24-bit integer)
-static inline Numb new_u24(u32 val) {
-  return (val << 5) | TY_U24;
+static inline Numb new_u24(UNum val) {
+  return ((Numb)val << 5) | TY_U24;
 }
 
-static inline u32 get_u24(Numb word) {
+static inline UNum get_u24(Numb word) {
   return word >> 5;
 }
 
 // Constructor and getters for I24 (signed 24-bit integer)
-static inline Numb new_i24(i32 val) {
-  return ((u32)val << 5) | TY_I24;
+static inline Numb new_i24(INum val) {
+  return ((Numb)(UNum)val << 5) | TY_I24;
 }
 
-static inline i32 get_i24(Numb word) {
-  return ((i32)word) << 3 >> 8;
+static inline INum get_i24(Numb word) {
+  return ((INum)word) << 3 >> 8;
 }
 
+#ifdef HVM64
+// Constructor and getters for F24 (a full f32, with HVM64)
+static inline Numb new_f24(float val) {
+  u32 bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return ((Numb)bits << 5) | TY_F24;
+}
+
+static inline float get_f24(Numb word) {
+  u32   bits = word >> 5;
+  float val;
+  memcpy(&val, &bits, sizeof(val));
+  return val;
+}
+#else
 // Constructor and getters for F24 (24-bit float)
 static inline Numb new_f24(float val) {
   u32 bits = *(u32*)&val;
@@ -173,6 +214,7 @@ static inline float get_f24(Numb word) {
   u32 bits = (word << 3) & 0xFFFFFF00;
   return *(float*)&bits;
 }
+#endif
 
 static inline Tag get_typ(Numb word) {
   return word & 0x1F;
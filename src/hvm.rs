@@ -1,14 +1,25 @@
-use std::sync::atomic::{AtomicU32, AtomicU64, Ordering};
-use std::alloc::{alloc, dealloc, Layout};
+use std::sync::atomic::{AtomicBool, AtomicU32, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Condvar, Mutex};
+use std::time::Duration;
+use std::alloc::{alloc, alloc_zeroed, dealloc, handle_alloc_error, Layout};
 use std::mem;
 
 // Runtime
 // =======
 
 // Types
+// With the `hvm64` feature, ports are 64-bit and pairs 128-bit, as with HVM64
+// in hvm.c: the heap may pass 2^29 locations, and numbers get wider.
 pub type Tag  = u8;  // Tag  ::= 3-bit (rounded up to u8)
 pub type Lab  = u32; // Lab  ::= 29-bit (rounded up to u32)
+#[cfg(not(feature = "hvm64"))]
 pub type Val  = u32; // Val  ::= 29-bit (rounded up to u32)
+#[cfg(feature = "hvm64")]
+pub type Val  = u64; // Val  ::= 61-bit (rounded up to u64)
+#[cfg(not(feature = "hvm64"))]
+pub type Vals = u64; // Vals ::= Val + Val (fits a u64)
+#[cfg(feature = "hvm64")]
+pub type Vals = u128; // Vals ::= Val + Val (fits a u128)
 pub type Rule = u8;  // Rule ::= 8-bit (fits a u8)
 
 // Port
@@ -16,19 +27,41 @@ pub type Rule = u8;  // Rule ::= 8-bit (fits a u8)
 pub struct Port(pub Val);
 
 // Pair
-pub struct Pair(pub u64);
+pub struct Pair(pub Vals);
 
 // Atomics
+#[cfg(not(feature = "hvm64"))]
 pub type AVal = AtomicU32;
+#[cfg(feature = "hvm64")]
+pub type AVal = AtomicU64;
 pub struct APort(pub AVal);
+#[cfg(not(feature = "hvm64"))]
 pub struct APair(pub AtomicU64);
+// A node is only accessed by the thread holding its redex, so each half can be
+// atomic on its own (there is no stable 128-bit atomic).
+#[cfg(feature = "hvm64")]
+pub struct APair(pub AtomicU64, pub AtomicU64);
 
 // Number
+// With `hvm64`, the u24/i24 types hold 56-bit integers, and f24 a full f32.
 pub struct Numb(pub Val);
-const U24_MAX : u32 = (1 << 24) - 1;
-const U24_MIN : u32 = 0;
-const I24_MAX : i32 = (1 << 23) - 1;
-const I24_MIN : i32 = (-1) << 23;
+#[cfg(not(feature = "hvm64"))]
+pub type UNum = u32; // unsigned payload
+#[cfg(not(feature = "hvm64"))]
+pub type INum = i32; // signed payload
+#[cfg(feature = "hvm64")]
+pub type UNum = u64;
+#[cfg(feature = "hvm64")]
+pub type INum = i64;
+#[cfg(not(feature = "hvm64"))]
+pub const NUMB_BITS : u32 = 24;
+#[cfg(feature = "hvm64")]
+pub const NUMB_BITS : u32 = 56;
+pub const U24_MAX : UNum = (1 << NUMB_BITS) - 1;
+pub const U24_MIN : UNum = 0;
+pub const I24_MAX : INum = (1 << (NUMB_BITS - 1)) - 1;
+pub const I24_MIN : INum = (-1) << (NUMB_BITS - 1);
+const SHIFT_MASK : UNum = UNum::BITS as UNum - 1; // shift amounts wrap around
 
 // Tags
 pub const VAR : Tag = 0x0; // variable
@@ -78,7 +111,23 @@ pub const FP_SHR : Tag = 0x16;
 // Constants
 pub const FREE : Port = Port(0x0);
 pub const ROOT : Port = Port(0xFFFFFF8);
-pub const NONE : Port = Port(0xFFFFFFFF);
+pub const NONE : Port = Port(Val::MAX);
+
+// Global Net
+pub const HEAP_LEN : usize = 0x2000000; // default node and vars buffer length
+#[cfg(not(feature = "hvm64"))]
+pub const HEAP_MAX : usize = 1 << 29; // max buffer length (29-bit vals)
+#[cfg(feature = "hvm64")]
+pub const HEAP_MAX : usize = 1 << 34; // max buffer length (256 GiB of nodes)
+
+// Allocator
+const FREE_LEN  : usize = 1 << 16; // max recycled locations per thread
+const FREE_BULK : usize = 1 << 12; // locations gathered per refill
+const CHUNK_LEN : usize = 1 << 12; // locations a thread claims at a time
+
+// Scheduler
+const IDLE_SPIN : u32 = 64; // failed steals before an idle thread parks
+const IDLE_WAIT : Duration = Duration::from_millis(1); // longest park
 
 // RBag
 pub struct RBag {
@@ -90,6 +139,10 @@ pub struct RBag {
 pub struct GNet {
   pub node: Box<[APair]>, // node buffer
   pub vars: Box<[APort]>, // vars buffer
+  pub nown: Box<[AtomicU32]>, // owner of each node chunk (tid + 1, or 0)
+  pub vown: Box<[AtomicU32]>, // owner of each vars chunk (tid + 1, or 0)
+  pub nnext: AtomicUsize, // next node chunk to claim
+  pub vnext: AtomicUsize, // next vars chunk to claim
   pub itrs: AtomicU64, // interaction count
 }
 
@@ -99,11 +152,38 @@ pub struct TMem {
   pub tids: u32, // thread count
   pub tick: u32, // tick counter
   pub itrs: u32, // interaction count
-  pub nput: usize, // next node allocation index
-  pub vput: usize, // next vars allocation index
+  pub nput: usize, // next never-used node location
+  pub vput: usize, // next never-used vars location
+  pub nend: usize, // end of the last node chunk claimed
+  pub vend: usize, // end of the last vars chunk claimed
+  pub nswp: usize, // node sweep cursor, over the chunks claimed
+  pub vswp: usize, // vars sweep cursor, over the chunks claimed
+  pub nchk: Vec<usize>, // node chunks claimed
+  pub vchk: Vec<usize>, // vars chunks claimed
   pub nloc: Vec<usize>, // allocated node locations
   pub vloc: Vec<usize>, // allocated vars locations
+  pub nfre: Vec<usize>, // recycled node locations
+  pub vfre: Vec<usize>, // recycled vars locations
   pub rbag: RBag, // local redex bag
+  pub oom: bool, // a `get_resources` call failed
+  pub hmax: usize, // peak high-priority redexes
+  pub rmax: usize, // peak redexes
+}
+
+// Scheduler
+// Each thread reduces its own redexes. When others are looking for work, it
+// moves half of its low-priority redexes (the oldest, which tend to be the
+// largest) to its share, where they can be stolen. `work` counts the busy
+// threads plus the shared redexes, so it only reaches 0 once all is done.
+// Idle threads retry stealing a few times, then park until woken.
+pub struct Sched {
+  pub share: Box<[Mutex<Vec<Pair>>]>, // redexes shared by each thread
+  pub slen: Box<[AtomicU32]>, // share lengths, read without locking
+  pub want: AtomicU32, // threads looking for work
+  pub work: AtomicU64, // busy threads plus shared redexes
+  pub halt: AtomicBool, // a thread ran out of memory
+  pub park: Mutex<()>, // idle threads wait on `wake` with this held
+  pub wake: Condvar, // signaled when redexes are shared, or all is done
 }
 
 // Top-Level Definition
@@ -169,9 +249,9 @@ impl Port {
     let tag = self.get_tag();
     let val = self.get_val();
     if self.is_nod() {
-      Port::new(tag, tm.nloc[val as usize] as u32)
+      Port::new(tag, tm.nloc[val as usize] as Val)
     } else if self.is_var() {
-      Port::new(tag, tm.vloc[val as usize] as u32)
+      Port::new(tag, tm.vloc[val as usize] as Val)
     } else {
       Port::new(tag, val)
     }
@@ -181,15 +261,15 @@ impl Port {
 
 impl Pair {
   pub fn new(fst: Port, snd: Port) -> Self {
-    Pair(((snd.0 as u64) << 32) | fst.0 as u64)
+    Pair(((snd.0 as Vals) << Val::BITS) | fst.0 as Vals)
   }
 
   pub fn get_fst(&self) -> Port {
-    Port((self.0 & 0xFFFFFFFF) as u32)
+    Port(self.0 as Val)
   }
 
   pub fn get_snd(&self) -> Port {
-    Port((self.0 >> 32) as u32)
+    Port((self.0 >> Val::BITS) as Val)
   }
 
   pub fn adjust_pair(&self, tm: &TMem) -> Pair {
@@ -232,26 +312,37 @@ impl Numb {
 
   // U24: unsigned 24-bit integer
 
-  pub fn new_u24(val: u32) -> Self {
+  pub fn new_u24(val: UNum) -> Self {
     Numb((val << 5) as Val | (TY_U24 as Val))
   }
 
-  pub fn get_u24(&self) -> u32 {
-    (self.0 >> 5) as u32
+  pub fn get_u24(&self) -> UNum {
+    (self.0 >> 5) as UNum
   }
 
   // I24: signed 24-bit integer
 
-  pub fn new_i24(val: i32) -> Self {
-    Numb(((val as u32) << 5) as Val | (TY_I24 as Val))
+  pub fn new_i24(val: INum) -> Self {
+    Numb(((val as UNum) << 5) as Val | (TY_I24 as Val))
+  }
+
+  pub fn get_i24(&self) -> INum {
+    (self.0 as INum) << 3 >> 8
   }
 
-  pub fn get_i24(&self) -> i32 {
-    (self.0 as i32) << 3 >> 8
+  // F24: 24-bit float (a full f32, with `hvm64`)
+
+  #[cfg(feature = "hvm64")]
+  pub fn new_f24(val: f32) -> Self {
+    Numb((val.to_bits() as Val) << 5 | (TY_F24 as Val))
   }
 
-  // F24: 24-bit float
+  #[cfg(feature = "hvm64")]
+  pub fn get_f24(&self) -> f32 {
+    f32::from_bits((self.0 >> 5) as u32)
+  }
 
+  #[cfg(not(feature = "hvm64"))]
   pub fn new_f24(val: f32) -> Self {
     let bits = val.to_bits();
     let mut shifted_bits = bits >> 8;
@@ -263,6 +354,7 @@ impl Numb {
     Numb((shifted_bits << 5) as Val | (TY_F24 as Val))
   }
 
+  #[cfg(not(feature = "hvm64"))]
   pub fn get_f24(&self) -> f32 {
     f32::from_bits((self.0 << 3) & 0xFFFFFF00)
   }
@@ -280,9 +372,20 @@ impl Numb {
     self.get_typ() == TY_SYM && self.get_sym() >= TY_U24 && self.get_sym() <= TY_F24
   }
 
+  // True if the number means the same in 32-bit builds.
+  #[cfg(feature = "hvm64")]
+  pub fn is_narrow(&self) -> bool {
+    match self.get_typ() {
+      TY_U24 => self.get_u24() <= 0xFFFFFF,
+      TY_I24 => self.get_i24() >= -0x800000 && self.get_i24() < 0x800000,
+      TY_F24 => (self.0 >> 5) & 0xFF == 0 || self.get_f24().is_nan(),
+      _      => true,
+    }
+  }
+
   // Partial application.
   pub fn partial(a: Self, b: Self) -> Self {
-    Numb((b.0 & !0x1F) | a.get_sym() as u32)
+    Numb((b.0 & !0x1F) | a.get_sym() as Val)
   }
 
   // Cast a number to another type.
@@ -296,12 +399,12 @@ impl Numb {
   pub fn cast(a: Self, b: Self) -> Self {
     match (a.get_sym(), b.get_typ()) {
       (TY_U24, TY_U24) => b,
-      (TY_U24, TY_I24) => Self::new_u24(b.get_i24() as u32),
-      (TY_U24, TY_F24) => Self::new_u24((b.get_f24() as u32).clamp(U24_MIN, U24_MAX)),
+      (TY_U24, TY_I24) => Self::new_u24(b.get_i24() as UNum),
+      (TY_U24, TY_F24) => Self::new_u24((b.get_f24() as UNum).clamp(U24_MIN, U24_MAX)),
 
-      (TY_I24, TY_U24) => Self::new_i24(b.get_u24() as i32),
+      (TY_I24, TY_U24) => Self::new_i24(b.get_u24() as INum),
       (TY_I24, TY_I24) => b,
-      (TY_I24, TY_F24) => Self::new_i24((b.get_f24() as i32).clamp(I24_MIN, I24_MAX)),
+      (TY_I24, TY_F24) => Self::new_i24((b.get_f24() as INum).clamp(I24_MIN, I24_MAX)),
 
       (TY_F24, TY_U24) => Self::new_f24(b.get_u24() as f32),
       (TY_F24, TY_I24) => Self::new_f24(b.get_i24() as f32),
@@ -350,17 +453,17 @@ impl Numb {
           FP_DIV => Numb::new_u24(bv.wrapping_div(av)),
           OP_REM => Numb::new_u24(av.wrapping_rem(bv)),
           FP_REM => Numb::new_u24(bv.wrapping_rem(av)),
-          OP_EQ  => Numb::new_u24((av == bv) as u32),
-          OP_NEQ => Numb::new_u24((av != bv) as u32),
-          OP_LT  => Numb::new_u24((av <  bv) as u32),
-          OP_GT  => Numb::new_u24((av >  bv) as u32),
+          OP_EQ  => Numb::new_u24((av == bv) as UNum),
+          OP_NEQ => Numb::new_u24((av != bv) as UNum),
+          OP_LT  => Numb::new_u24((av <  bv) as UNum),
+          OP_GT  => Numb::new_u24((av >  bv) as UNum),
           OP_AND => Numb::new_u24(av & bv),
           OP_OR  => Numb::new_u24(av | bv),
           OP_XOR => Numb::new_u24(av ^ bv),
-          OP_SHL => Numb::new_u24(av << (bv & 31)),
-          OP_SHR => Numb::new_u24(av >> (bv & 31)),
-          FP_SHL => Numb::new_u24(bv << (av & 31)),
-          FP_SHR => Numb::new_u24(bv >> (av & 31)),
+          OP_SHL => Numb::new_u24(av << (bv & SHIFT_MASK)),
+          OP_SHR => Numb::new_u24(av >> (bv & SHIFT_MASK)),
+          FP_SHL => Numb::new_u24(bv << (av & SHIFT_MASK)),
+          FP_SHR => Numb::new_u24(bv >> (av & SHIFT_MASK)),
           _      => unreachable!(),
         }
       }
@@ -376,10 +479,10 @@ impl Numb {
           FP_DIV => Numb::new_i24(bv.wrapping_div(av)),
           OP_REM => Numb::new_i24(av.wrapping_rem(bv)),
           FP_REM => Numb::new_i24(bv.wrapping_rem(av)),
-          OP_EQ  => Numb::new_u24((av == bv) as u32),
-          OP_NEQ => Numb::new_u24((av != bv) as u32),
-          OP_LT  => Numb::new_u24((av <  bv) as u32),
-          OP_GT  => Numb::new_u24((av >  bv) as u32),
+          OP_EQ  => Numb::new_u24((av == bv) as UNum),
+          OP_NEQ => Numb::new_u24((av != bv) as UNum),
+          OP_LT  => Numb::new_u24((av <  bv) as UNum),
+          OP_GT  => Numb::new_u24((av >  bv) as UNum),
           OP_AND => Numb::new_i24(av & bv),
           OP_OR  => Numb::new_i24(av | bv),
           OP_XOR => Numb::new_i24(av ^ bv),
@@ -398,10 +501,10 @@ impl Numb {
           FP_DIV => Numb::new_f24(bv / av),
           OP_REM => Numb::new_f24(av % bv),
           FP_REM => Numb::new_f24(bv % av),
-          OP_EQ  => Numb::new_u24((av == bv) as u32),
-          OP_NEQ => Numb::new_u24((av != bv) as u32),
-          OP_LT  => Numb::new_u24((av <  bv) as u32),
-          OP_GT  => Numb::new_u24((av >  bv) as u32),
+          OP_EQ  => Numb::new_u24((av == bv) as UNum),
+          OP_NEQ => Numb::new_u24((av != bv) as UNum),
+          OP_LT  => Numb::new_u24((av <  bv) as UNum),
+          OP_GT  => Numb::new_u24((av >  bv) as UNum),
           OP_AND => Numb::new_f24(av.atan2(bv)),
           OP_OR  => Numb::new_f24(bv.log(av)),
           OP_XOR => Numb::new_f24(av.powf(bv)),
@@ -415,6 +518,39 @@ impl Numb {
   }
 }
 
+#[cfg(not(feature = "hvm64"))]
+impl APair {
+  pub fn load(&self) -> Pair {
+    Pair(self.0.load(Ordering::Relaxed))
+  }
+
+  pub fn store(&self, val: Pair) {
+    self.0.store(val.0, Ordering::Relaxed);
+  }
+
+  pub fn swap(&self, val: Pair) -> Pair {
+    Pair(self.0.swap(val.0, Ordering::Relaxed))
+  }
+}
+
+#[cfg(feature = "hvm64")]
+impl APair {
+  pub fn load(&self) -> Pair {
+    Pair::new(Port(self.0.load(Ordering::Relaxed)), Port(self.1.load(Ordering::Relaxed)))
+  }
+
+  pub fn store(&self, val: Pair) {
+    self.0.store(val.get_fst().0, Ordering::Relaxed);
+    self.1.store(val.get_snd().0, Ordering::Relaxed);
+  }
+
+  pub fn swap(&self, val: Pair) -> Pair {
+    let fst = self.0.swap(val.get_fst().0, Ordering::Relaxed);
+    let snd = self.1.swap(val.get_snd().0, Ordering::Relaxed);
+    Pair::new(Port(fst), Port(snd))
+  }
+}
+
 impl RBag {
   pub fn new() -> Self {
     RBag {
@@ -449,15 +585,37 @@ impl RBag {
   }
 }
 
+// Allocates a zeroed buffer. Its pages are only committed when touched.
+fn alloc_buffer<T>(len: usize) -> Box<[T]> {
+  let layout = Layout::array::<T>(len).unwrap();
+  unsafe {
+    let ptr = alloc_zeroed(layout) as *mut T;
+    if ptr.is_null() {
+      handle_alloc_error(layout);
+    }
+    Box::from_raw(std::ptr::slice_from_raw_parts_mut(ptr, len))
+  }
+}
+
 impl GNet {
   pub fn new(nlen: usize, vlen: usize) -> Self {
-    let node = (0..nlen).map(|_| APair(AtomicU64::new(0))).collect();
-    let vars = (0..vlen).map(|_| APort(AtomicU32::new(0))).collect();
-    GNet { node, vars, itrs: AtomicU64::new(0) }
+    // All-zero atomics are valid (and free) entries
+    let node = alloc_buffer::<APair>(nlen);
+    let vars = alloc_buffer::<APort>(vlen);
+    let nown = (0..nlen.div_ceil(CHUNK_LEN)).map(|_| AtomicU32::new(0)).collect();
+    let vown = (0..vlen.div_ceil(CHUNK_LEN)).map(|_| AtomicU32::new(0)).collect();
+    GNet { node, vars, nown, vown, nnext: AtomicUsize::new(0), vnext: AtomicUsize::new(0), itrs: AtomicU64::new(0) }
+  }
+
+  // Builds a net for a heap of about `size` bytes. The vars buffer always
+  // reaches ROOT.
+  pub fn with_heap(size: usize) -> Self {
+    let len = (size / (mem::size_of::<APair>() + mem::size_of::<APort>())).clamp(2, HEAP_MAX);
+    GNet::new(len, len.max(ROOT.get_val() as usize + 1))
   }
 
   pub fn node_create(&self, loc: usize, val: Pair) {
-    self.node[loc].0.store(val.0, Ordering::Relaxed);
+    self.node[loc].store(val);
   }
 
   pub fn vars_create(&self, var: usize, val: Port) {
@@ -465,15 +623,15 @@ impl GNet {
   }
 
   pub fn node_load(&self, loc: usize) -> Pair {
-    Pair(self.node[loc].0.load(Ordering::Relaxed))
+    self.node[loc].load()
   }
 
   pub fn vars_load(&self, var: usize) -> Port {
-    Port(self.vars[var].0.load(Ordering::Relaxed) as u32)
+    Port(self.vars[var].0.load(Ordering::Relaxed))
   }
 
   pub fn node_store(&self, loc: usize, val: Pair) {
-    self.node[loc].0.store(val.0, Ordering::Relaxed);
+    self.node[loc].store(val);
   }
 
   pub fn vars_store(&self, var: usize, val: Port) {
@@ -481,11 +639,11 @@ impl GNet {
   }
 
   pub fn node_exchange(&self, loc: usize, val: Pair) -> Pair {
-    Pair(self.node[loc].0.swap(val.0, Ordering::Relaxed))
+    self.node[loc].swap(val)
   }
 
   pub fn vars_exchange(&self, var: usize, val: Port) -> Port {
-    Port(self.vars[var].0.swap(val.0, Ordering::Relaxed) as u32)
+    Port(self.vars[var].0.swap(val.0, Ordering::Relaxed))
   }
 
   pub fn node_take(&self, loc: usize) -> Pair {
@@ -504,6 +662,32 @@ impl GNet {
     self.vars_load(var).0 == 0
   }
 
+  // Claims the next unclaimed chunk of a buffer for thread `tid`, if any.
+  fn claim(own: &[AtomicU32], next: &AtomicUsize, tid: u32) -> Option<usize> {
+    let chk = next.fetch_add(1, Ordering::Relaxed);
+    let own = own.get(chk)?;
+    own.store(tid + 1, Ordering::Relaxed);
+    Some(chk)
+  }
+
+  pub fn node_claim(&self, tid: u32) -> Option<usize> {
+    GNet::claim(&self.nown, &self.nnext, tid)
+  }
+
+  pub fn vars_claim(&self, tid: u32) -> Option<usize> {
+    GNet::claim(&self.vown, &self.vnext, tid)
+  }
+
+  // Whether thread `tid` claimed the chunk holding a location. A thread always
+  // sees its own claims, which is all recycling needs.
+  pub fn node_owned(&self, loc: usize, tid: u32) -> bool {
+    self.nown[loc / CHUNK_LEN].load(Ordering::Relaxed) == tid + 1
+  }
+
+  pub fn vars_owned(&self, var: usize, tid: u32) -> bool {
+    self.vown[var / CHUNK_LEN].load(Ordering::Relaxed) == tid + 1
+  }
+
   pub fn enter(&self, mut var: Port) -> Port {
     // While `B` is VAR: extend it (as an optimization)
     while var.get_tag() == VAR {
@@ -532,50 +716,195 @@ impl TMem {
       itrs: 0,
       nput: 0,
       vput: 0,
+      nend: 0,
+      vend: 0,
+      nswp: 0,
+      vswp: 0,
+      nchk: Vec::new(),
+      vchk: Vec::new(),
       nloc: vec![0; 0xFFF], // FIXME: move to a constant
       vloc: vec![0; 0xFFF],
+      nfre: Vec::with_capacity(FREE_LEN),
+      vfre: Vec::with_capacity(FREE_LEN),
       rbag: RBag::new(),
+      oom: false,
+      hmax: 0,
+      rmax: 0,
     }
   }
 
-  pub fn node_alloc(&mut self, net: &GNet, num: usize) -> usize {
-    let mut got = 0;
-    let nlen = net.node.len();
-    for _ in 0..nlen {
-      self.nput += 1; // index 0 reserved
-      if self.nput < nlen || net.is_node_free(self.nput % nlen) {
-        self.nloc[got] = self.nput % nlen;
-        got += 1;
-        //println!("ALLOC NODE {} {}", got, self.nput);
+  // Locations released by `node_take` / `vars_take` are recycled through the
+  // free stacks. Each thread claims chunks of the buffers as it needs them, and
+  // only allocates, and recycles, locations on the chunks it claimed. When a
+  // stack runs short, it is refilled in bulk: first with never-used locations
+  // of the last chunk claimed, then by a sweep of all its chunks that rebuilds
+  // the stack from scratch (so nothing is listed twice). If the sweep finds its
+  // chunks crowded, the thread claims another one. Out of memory is only
+  // reported once no chunk is left, so a lone busy thread can use the whole
+  // heap.
+
+  pub fn node_refill(&mut self, net: &GNet, num: usize) {
+    loop {
+      // Takes never-used locations.
+      while self.nput < self.nend && self.nfre.len() < FREE_BULK {
+        let loc = self.nput;
+        self.nput += 1;
+        if loc != 0 && net.is_node_free(loc) {
+          self.nfre.push(loc);
+        }
       }
-      if got >= num {
-        break;
+      if self.nfre.len() >= num {
+        return;
+      }
+      // Sweeps the chunks claimed for empty locations.
+      let len = self.nchk.len() * CHUNK_LEN;
+      let mut lps = 0;
+      self.nfre.clear();
+      while lps < len && self.nfre.len() < FREE_BULK {
+        let loc = self.nchk[self.nswp / CHUNK_LEN] * CHUNK_LEN + self.nswp % CHUNK_LEN;
+        self.nswp = (self.nswp + 1) % len;
+        lps += 1;
+        if loc != 0 && loc < net.node.len() && net.is_node_free(loc) {
+          self.nfre.push(loc);
+        }
+      }
+      // If they're crowded (or too few for the request), claims another chunk.
+      if self.nfre.len() * 8 <= lps || self.nfre.len() < num {
+        if let Some(chk) = net.node_claim(self.tid) {
+          self.nchk.push(chk);
+          self.nput = chk * CHUNK_LEN;
+          self.nend = (self.nput + CHUNK_LEN).min(net.node.len());
+          continue;
+        }
       }
+      return;
     }
-    return got
   }
 
-  pub fn vars_alloc(&mut self, net: &GNet, num: usize) -> usize {
-    let mut got = 0;
-    let vlen = net.vars.len();
-    for _ in 0..vlen {
-      self.vput += 1; // index 0 reserved for FREE
-      if self.vput < vlen || net.is_vars_free(self.vput % vlen) {
-        self.vloc[got] = self.vput % vlen;
-        //println!("ALLOC VARS {} {}", got, self.vput);
-        got += 1;
+  pub fn vars_refill(&mut self, net: &GNet, num: usize) {
+    loop {
+      // Takes never-used locations.
+      while self.vput < self.vend && self.vfre.len() < FREE_BULK {
+        let var = self.vput;
+        self.vput += 1;
+        if var != 0 && var != ROOT.get_val() as usize && net.is_vars_free(var) {
+          self.vfre.push(var);
+        }
       }
-      if got >= num {
-        break;
+      if self.vfre.len() >= num {
+        return;
       }
+      // Sweeps the chunks claimed for empty locations.
+      let len = self.vchk.len() * CHUNK_LEN;
+      let mut lps = 0;
+      self.vfre.clear();
+      while lps < len && self.vfre.len() < FREE_BULK {
+        let var = self.vchk[self.vswp / CHUNK_LEN] * CHUNK_LEN + self.vswp % CHUNK_LEN;
+        self.vswp = (self.vswp + 1) % len;
+        lps += 1;
+        if var != 0 && var != ROOT.get_val() as usize && var < net.vars.len() && net.is_vars_free(var) {
+          self.vfre.push(var);
+        }
+      }
+      // If they're crowded (or too few for the request), claims another chunk.
+      if self.vfre.len() * 8 <= lps || self.vfre.len() < num {
+        if let Some(chk) = net.vars_claim(self.tid) {
+          self.vchk.push(chk);
+          self.vput = chk * CHUNK_LEN;
+          self.vend = (self.vput + CHUNK_LEN).min(net.vars.len());
+          continue;
+        }
+      }
+      return;
+    }
+  }
+
+  // Locations handed out from never-used ones: (nodes, vars).
+  pub fn span(&self) -> (usize, usize) {
+    let span = |chks: &[usize], put: usize| chks.last().map_or(0, |last| (chks.len() - 1) * CHUNK_LEN + put - last * CHUNK_LEN);
+    (span(&self.nchk, self.nput), span(&self.vchk, self.vput))
+  }
+
+  pub fn node_alloc(&mut self, net: &GNet, num: usize) -> usize {
+    if self.nfre.len() < num {
+      self.node_refill(net, num);
+    }
+    let got = num.min(self.nfre.len());
+    for i in 0..got {
+      self.nloc[i] = self.nfre.pop().unwrap();
     }
     got
   }
 
+  pub fn vars_alloc(&mut self, net: &GNet, num: usize) -> usize {
+    if self.vfre.len() < num {
+      self.vars_refill(net, num);
+    }
+    let got = num.min(self.vfre.len());
+    for i in 0..got {
+      self.vloc[i] = self.vfre.pop().unwrap();
+    }
+    got
+  }
+
+  pub fn node_free(&mut self, loc: usize) {
+    if self.nfre.len() < FREE_LEN {
+      self.nfre.push(loc);
+    }
+  }
+
+  pub fn vars_free(&mut self, var: usize) {
+    if self.vfre.len() < FREE_LEN && var != ROOT.get_val() as usize {
+      self.vfre.push(var);
+    }
+  }
+
+  // Takes a node, recycling its location if it is on this thread's chunks.
+  pub fn node_take(&mut self, net: &GNet, loc: usize) -> Pair {
+    let got = net.node_take(loc);
+    if got.0 != 0 && net.node_owned(loc, self.tid) {
+      self.node_free(loc);
+    }
+    got
+  }
+
+  // Takes a var, recycling its location if it is on this thread's chunks.
+  pub fn vars_take(&mut self, net: &GNet, var: usize) -> Port {
+    let got = net.vars_take(var);
+    if got.0 != 0 && net.vars_owned(var, self.tid) {
+      self.vars_free(var);
+    }
+    got
+  }
+
+  // Same as `GNet::enter`, recycling the vars it deletes.
+  pub fn enter(&mut self, net: &GNet, mut var: Port) -> Port {
+    while var.get_tag() == VAR {
+      let val = net.vars_exchange(var.get_val() as usize, NONE);
+      if val == NONE || val == Port(0) {
+        break;
+      }
+      self.vars_take(net, var.get_val() as usize);
+      var = val;
+    }
+    return var;
+  }
+
   pub fn get_resources(&mut self, net: &GNet, _need_rbag: usize, need_node: usize, need_vars: usize) -> bool {
     let got_node = self.node_alloc(net, need_node);
     let got_vars = self.vars_alloc(net, need_vars);
-    got_node >= need_node && got_vars >= need_vars
+    let got = got_node >= need_node && got_vars >= need_vars;
+    if !got {
+      // Hands back the locations we did get, so they aren't lost
+      for i in 0..got_node {
+        self.node_free(self.nloc[i]);
+      }
+      for i in 0..got_vars {
+        self.vars_free(self.vloc[i]);
+      }
+    }
+    self.oom |= !got;
+    got
   }
 
   // Atomically Links `A ~ B`.
@@ -598,7 +927,7 @@ impl TMem {
       }
 
       // While `B` is VAR: extend it (as an optimization)
-      b = net.enter(b);
+      b = self.enter(net, b);
 
       // Since `A` is VAR: point `A ~> B`.
       if true {
@@ -609,7 +938,7 @@ impl TMem {
           break;
         }
         // Otherwise, delete `A` (we own both) and link `A' ~ B`
-        net.vars_take(a.get_val() as usize);
+        self.vars_take(net, a.get_val() as usize);
         a = a_;
       }
     }
@@ -698,7 +1027,7 @@ impl TMem {
     }
 
     // Loads ports.
-    let b_ = net.node_exchange(b.get_val() as usize, Pair(0));
+    let b_ = self.node_take(net, b.get_val() as usize);
     let b1 = b_.get_fst();
     let b2 = b_.get_snd();
 
@@ -722,10 +1051,10 @@ impl TMem {
     }
 
     // Loads ports.
-    let a_ = net.node_take(a.get_val() as usize);
+    let a_ = self.node_take(net, a.get_val() as usize);
     let a1 = a_.get_fst();
     let a2 = a_.get_snd();
-    let b_ = net.node_take(b.get_val() as usize);
+    let b_ = self.node_take(net, b.get_val() as usize);
     let b1 = b_.get_fst();
     let b2 = b_.get_snd();
 
@@ -738,21 +1067,21 @@ impl TMem {
 
   // The Comm Interaction.
   pub fn interact_comm(&mut self, net: &GNet, a: Port, b: Port) -> bool {
-    // Allocates needed nodes and vars.
-    if !self.get_resources(net, 4, 4, 4) {
+    // Checks availability (first, so a redex that is retried allocates nothing)
+    if net.node_load(a.get_val() as usize).0 == 0 || net.node_load(b.get_val() as usize).0 == 0 {
       return false;
     }
 
-    // Checks availability
-    if net.node_load(a.get_val() as usize).0 == 0 || net.node_load(b.get_val() as usize).0 == 0 {
+    // Allocates needed nodes and vars.
+    if !self.get_resources(net, 4, 4, 4) {
       return false;
     }
 
     // Loads ports.
-    let a_ = net.node_take(a.get_val() as usize);
+    let a_ = self.node_take(net, a.get_val() as usize);
     let a1 = a_.get_fst();
     let a2 = a_.get_snd();
-    let b_ = net.node_take(b.get_val() as usize);
+    let b_ = self.node_take(net, b.get_val() as usize);
     let b1 = b_.get_fst();
     let b2 = b_.get_snd();
 
@@ -763,47 +1092,48 @@ impl TMem {
     net.vars_create(self.vloc[3], NONE);
 
     // Stores new nodes.
-    net.node_create(self.nloc[0], Pair::new(Port::new(VAR, self.vloc[0] as u32), Port::new(VAR, self.vloc[1] as u32)));
-    net.node_create(self.nloc[1], Pair::new(Port::new(VAR, self.vloc[2] as u32), Port::new(VAR, self.vloc[3] as u32)));
-    net.node_create(self.nloc[2], Pair::new(Port::new(VAR, self.vloc[0] as u32), Port::new(VAR, self.vloc[2] as u32)));
-    net.node_create(self.nloc[3], Pair::new(Port::new(VAR, self.vloc[1] as u32), Port::new(VAR, self.vloc[3] as u32)));
+    net.node_create(self.nloc[0], Pair::new(Port::new(VAR, self.vloc[0] as Val), Port::new(VAR, self.vloc[1] as Val)));
+    net.node_create(self.nloc[1], Pair::new(Port::new(VAR, self.vloc[2] as Val), Port::new(VAR, self.vloc[3] as Val)));
+    net.node_create(self.nloc[2], Pair::new(Port::new(VAR, self.vloc[0] as Val), Port::new(VAR, self.vloc[2] as Val)));
+    net.node_create(self.nloc[3], Pair::new(Port::new(VAR, self.vloc[1] as Val), Port::new(VAR, self.vloc[3] as Val)));
 
     // Links.
-    self.link_pair(net, Pair::new(Port::new(b.get_tag(), self.nloc[0] as u32), a1));
-    self.link_pair(net, Pair::new(Port::new(b.get_tag(), self.nloc[1] as u32), a2));
-    self.link_pair(net, Pair::new(Port::new(a.get_tag(), self.nloc[2] as u32), b1));
-    self.link_pair(net, Pair::new(Port::new(a.get_tag(), self.nloc[3] as u32), b2));
+    self.link_pair(net, Pair::new(Port::new(b.get_tag(), self.nloc[0] as Val), a1));
+    self.link_pair(net, Pair::new(Port::new(b.get_tag(), self.nloc[1] as Val), a2));
+    self.link_pair(net, Pair::new(Port::new(a.get_tag(), self.nloc[2] as Val), b1));
+    self.link_pair(net, Pair::new(Port::new(a.get_tag(), self.nloc[3] as Val), b2));
 
     true
   }
 
   // The Oper Interaction.
   pub fn interact_oper(&mut self, net: &GNet, a: Port, b: Port) -> bool {
-    // Allocates needed nodes and vars.
-    if !self.get_resources(net, 1, 1, 0) {
+    // Checks availability (first, so a redex that is retried allocates nothing)
+    if net.node_load(b.get_val() as usize).0 == 0 {
       return false;
     }
 
-    // Checks availability
-    if net.node_load(b.get_val() as usize).0 == 0 {
+    // Allocates needed nodes and vars.
+    if !self.get_resources(net, 1, 1, 0) {
       return false;
     }
 
     assert_eq!(a.get_tag(), NUM);
     // Loads ports.
     let av = a.get_val();
-    let b_ = net.node_take(b.get_val() as usize);
+    let b_ = self.node_take(net, b.get_val() as usize);
     let b1 = b_.get_fst();
-    let b2 = net.enter(b_.get_snd());
+    let b2 = self.enter(net, b_.get_snd());
 
     // Performs operation.
     if b1.get_tag() == NUM {
       let bv = b1.get_val();
       let cv = Numb::operate(Numb(av), Numb(bv));
       self.link_pair(net, Pair::new(Port::new(NUM, cv.0), b2));
+      self.node_free(self.nloc[0]);
     } else {
       net.node_create(self.nloc[0], Pair::new(Port::new(a.get_tag(), Numb(a.get_val()).0), b2));
-      self.link_pair(net, Pair::new(b1, Port::new(OPR, self.nloc[0] as u32)));
+      self.link_pair(net, Pair::new(b1, Port::new(OPR, self.nloc[0] as Val)));
     }
 
     true
@@ -811,30 +1141,31 @@ impl TMem {
 
   // The Swit Interaction.
   pub fn interact_swit(&mut self, net: &GNet, a: Port, b: Port) -> bool {
-    // Allocates needed nodes and vars.
-    if !self.get_resources(net, 1, 2, 0) {
+    // Checks availability (first, so a redex that is retried allocates nothing)
+    if net.node_load(b.get_val() as usize).0 == 0 {
       return false;
     }
 
-    // Checks availability
-    if net.node_load(b.get_val() as usize).0 == 0 {
+    // Allocates needed nodes and vars.
+    if !self.get_resources(net, 1, 2, 0) {
       return false;
     }
 
     // Loads ports.
     let av = Numb(a.get_val()).get_u24();
-    let b_ = net.node_take(b.get_val() as usize);
+    let b_ = self.node_take(net, b.get_val() as usize);
     let b1 = b_.get_fst();
     let b2 = b_.get_snd();
 
     // Stores new nodes.
     if av == 0 {
       net.node_create(self.nloc[0], Pair::new(b2, Port::new(ERA,0)));
-      self.link_pair(net, Pair::new(Port::new(CON, self.nloc[0] as u32), b1));
+      self.link_pair(net, Pair::new(Port::new(CON, self.nloc[0] as Val), b1));
+      self.node_free(self.nloc[1]);
     } else {
-      net.node_create(self.nloc[0], Pair::new(Port::new(ERA,0), Port::new(CON, self.nloc[1] as u32)));
+      net.node_create(self.nloc[0], Pair::new(Port::new(ERA,0), Port::new(CON, self.nloc[1] as Val)));
       net.node_create(self.nloc[1], Pair::new(Port::new(NUM, Numb::new_u24(av-1).0), b2));
-      self.link_pair(net, Pair::new(Port::new(CON, self.nloc[0] as u32), b1));
+      self.link_pair(net, Pair::new(Port::new(CON, self.nloc[0] as Val), b1));
     }
 
     true
@@ -890,51 +1221,128 @@ impl TMem {
     }
   }
 
-  pub fn evaluator(&mut self, net: &GNet, book: &Book) -> bool {
-    // Increments the tick
-    self.tick += 1;
-
-    // DEBUG:
-    //let mut max_rlen = 0;
-    //let mut max_nlen = 0;
-    //let mut max_vlen = 0;
+  // Shares half of the local low-priority redexes, if a thread is looking for
+  // work and our previous share was taken.
+  pub fn share(&mut self, sched: &Sched) {
+    let tid = self.tid as usize;
+    if self.rbag.lo.len() > 1 && sched.want.load(Ordering::Relaxed) > 0 && sched.slen[tid].load(Ordering::Relaxed) == 0 {
+      let half = self.rbag.lo.len() / 2;
+      let mut share = sched.share[tid].lock().unwrap();
+      sched.work.fetch_add(half as u64, Ordering::SeqCst);
+      share.extend(self.rbag.lo.drain(..half));
+      sched.slen[tid].store(share.len() as u32, Ordering::Relaxed);
+      drop(share);
+      sched.wake_one();
+    }
+  }
 
-    // Performs some interactions
-    while self.rbag.len() > 0 {
-      if !self.interact(net, book) {
-        return false;
+  // Steals the redexes another thread shared. Returns whether it got any.
+  pub fn steal(&mut self, sched: &Sched) -> bool {
+    for i in 1..self.tids {
+      let vic = ((self.tid + self.tick + i) % self.tids) as usize;
+      if sched.slen[vic].load(Ordering::Relaxed) == 0 {
+        continue;
       }
+      if let Ok(mut share) = sched.share[vic].try_lock() {
+        let len = share.len();
+        if len > 0 {
+          // Counts ourselves busy before the redexes leave the share
+          sched.work.fetch_add(1, Ordering::SeqCst);
+          for redex in share.drain(..) {
+            self.rbag.push_redex(redex);
+          }
+          sched.slen[vic].store(0, Ordering::Relaxed);
+          sched.work.fetch_sub(len as u64, Ordering::SeqCst);
+          return true;
+        }
+      }
+    }
+    false
+  }
 
-      // DEBUG:
-      //println!("{}{}", self.rbag.show(), net.show());
-      //println!("");
-      //let rlen = self.rbag.lo.len() + self.rbag.hi.len();
-      //let mut nlen = 0;
-      //for i in 0 .. 256 {
-        //if net.node_load(i).0 != 0 {
-          //nlen += 1;
-        //}
-      //}
-      //let mut vlen = 0;
-      //for i in 0..256 {
-        //if net.vars_load(i).0 != 0 {
-          //vlen += 1;
-        //}
-      //}
-      //max_rlen = max_rlen.max(rlen);
-      //max_nlen = max_nlen.max(nlen);
-      //max_vlen = max_vlen.max(vlen);
-
-    }
-
-    // DEBUG:
-    //println!("MAX_RLEN: {}", max_rlen);
-    //println!("MAX_NLEN: {}", max_nlen);
-    //println!("MAX_VLEN: {}", max_vlen);
+  // Reduces until all threads run out of redexes. Thread 0 starts with the
+  // initial redex. Returns false if a thread ran out of memory.
+  pub fn evaluator(&mut self, net: &GNet, book: &Book, sched: &Sched) -> bool {
+    let mut busy = self.tid == 0;
+    let mut idle = 0;
+    loop {
+      // If we have redexes, reduce one, sharing some if others are idle
+      let rlen = self.rbag.len();
+      if rlen > 0 {
+        self.rmax = self.rmax.max(rlen);
+        self.hmax = self.hmax.max(self.rbag.hi.len());
+        if !self.interact(net, book) && self.oom {
+          sched.halt.store(true, Ordering::Relaxed);
+          sched.wake_all();
+          break;
+        }
+        self.share(sched);
+      // Otherwise, look for work, halting once all is done
+      } else {
+        if busy {
+          busy = false;
+          sched.want.fetch_add(1, Ordering::Relaxed);
+          if sched.work.fetch_sub(1, Ordering::SeqCst) == 1 {
+            sched.wake_all();
+          }
+        }
+        if sched.work.load(Ordering::SeqCst) == 0 || sched.halt.load(Ordering::Relaxed) {
+          break;
+        }
+        self.tick += 1;
+        if self.steal(sched) {
+          busy = true;
+          idle = 0;
+          sched.want.fetch_sub(1, Ordering::Relaxed);
+        } else if idle < IDLE_SPIN {
+          idle += 1;
+          std::thread::yield_now();
+        } else {
+          sched.wait();
+        }
+      }
+      if busy && sched.halt.load(Ordering::Relaxed) {
+        break;
+      }
+    }
 
     net.itrs.fetch_add(self.itrs as u64, Ordering::Relaxed);
     self.itrs = 0;
-    true
+    !sched.halt.load(Ordering::Relaxed)
+  }
+}
+
+impl Sched {
+  pub fn new(tids: u32) -> Self {
+    Sched {
+      share: (0..tids).map(|_| Mutex::new(Vec::new())).collect(),
+      slen: (0..tids).map(|_| AtomicU32::new(0)).collect(),
+      want: AtomicU32::new(tids - 1), // all but thread 0
+      work: AtomicU64::new(1), // thread 0
+      halt: AtomicBool::new(false),
+      park: Mutex::new(()),
+      wake: Condvar::new(),
+    }
+  }
+
+  // Parks an idle thread until redexes are shared or all work is done. The
+  // timeout only bounds the cost of a missed wakeup.
+  pub fn wait(&self) {
+    let park = self.park.lock().unwrap();
+    let done = self.work.load(Ordering::SeqCst) == 0 || self.halt.load(Ordering::Relaxed);
+    if !done && self.slen.iter().all(|len| len.load(Ordering::Relaxed) == 0) {
+      let _ = self.wake.wait_timeout(park, IDLE_WAIT).unwrap();
+    }
+  }
+
+  pub fn wake_one(&self) {
+    let _park = self.park.lock().unwrap();
+    self.wake.notify_one();
+  }
+
+  pub fn wake_all(&self) {
+    let _park = self.park.lock().unwrap();
+    self.wake.notify_all();
   }
 }
 
@@ -946,6 +1354,9 @@ impl Book {
     // Writes the number of defs
     buf.extend_from_slice(&(self.defs.len() as u32).to_ne_bytes());
 
+    // Writes the port size, in 32-bit words (2 with `hvm64`)
+    buf.extend_from_slice(&(std::mem::size_of::<Port>() as u32 / 4).to_ne_bytes());
+
     // For each def
     for (fid, def) in self.defs.iter().enumerate() {
       // Writes the safe flag
@@ -4,6 +4,7 @@
 
 use clap::{Arg, ArgAction, Command};
 use ::hvm::{ast, cmp, hvm};
+use std::ffi::CString;
 use std::fs;
 use std::io::Write;
 use std::path::PathBuf;
@@ -12,6 +13,15 @@ use std::process::Command as SysCommand;
 #[cfg(feature = "c")]
 extern "C" {
   fn hvm_c(book_buffer: *const u32);
+  fn hvm_c_opt(key: *const std::ffi::c_char, val: *const std::ffi::c_char) -> bool;
+}
+
+// Runtime options forwarded to the C runtime (also accepted by `gen-c` binaries).
+const C_OPTS: &[&str] = &["heap", "heap-init", "hugepages", "compact", "threads", "pin", "sched", "sched-low", "sched-high", "batch", "oper-batch", "stats", "profile", "sample", "sample-file", "report", "trace"];
+
+// Process cpu time, in ticks of CLOCKS_PER_SEC (a million, on POSIX systems).
+extern "C" {
+  fn clock() -> std::ffi::c_long;
 }
 
 #[cfg(feature = "cuda")]
@@ -28,7 +38,20 @@ fn main() {
     .subcommand(
       Command::new("run")
         .about("Interprets a file (using Rust)")
-        .arg(Arg::new("file").required(true)))
+        .arg(Arg::new("file").required(true))
+        .arg(Arg::new("heap")
+          .long("heap")
+          .value_name("SIZE")
+          .help("Heap size, e.g. 4G (default: 384M)"))
+        .arg(Arg::new("threads")
+          .long("threads")
+          .value_name("N")
+          .help("Evaluation threads (default: HVM_THREADS, else the usable cpus)"))
+        .arg(Arg::new("report")
+          .long("report")
+          .value_name("FORMAT")
+          .value_parser(["text", "json"])
+          .help("Run report format: text, or json with peak heap and bag usage (default: text)")))
     .subcommand(
       Command::new("run-c")
         .about("Interprets a file (using C)")
@@ -37,6 +60,75 @@ fn main() {
           .long("io")
           .action(ArgAction::SetTrue)
           .help("Run with IO enabled"))
+        .arg(Arg::new("heap")
+          .long("heap")
+          .value_name("SIZE")
+          .help("Maximum heap size, e.g. 4G (default: available memory)"))
+        .arg(Arg::new("heap-init")
+          .long("heap-init")
+          .value_name("SIZE")
+          .help("Heap committed at startup (it grows as needed)"))
+        .arg(Arg::new("hugepages")
+          .long("hugepages")
+          .action(ArgAction::SetTrue)
+          .help("Back the heap with huge pages (hugetlbfs, else transparent)"))
+        .arg(Arg::new("compact")
+          .long("compact")
+          .value_name("RATIO")
+          .help("Compact the heap between IO steps once it spans RATIO times the live net (default: 2, 0 = never)"))
+        .arg(Arg::new("threads")
+          .long("threads")
+          .value_name("N")
+          .help("Evaluation threads (default: HVM_THREADS, else the usable cpus, respecting cgroup quotas)"))
+        .arg(Arg::new("pin")
+          .long("pin")
+          .value_name("POLICY")
+          .help("Pin threads to cpus: none, compact, cores (one per core before SMT siblings) or scatter (default: none)"))
+        .arg(Arg::new("sched")
+          .long("sched")
+          .value_name("POLICY")
+          .help("Redex order: fixed, adaptive (more depth-first as live nodes fill the heap) or depth (default: adaptive)"))
+        .arg(Arg::new("sched-low")
+          .long("sched-low")
+          .value_name("PERCENT")
+          .help("Heap occupancy at which the adaptive order keeps OPER and SWIT local (default: 50)"))
+        .arg(Arg::new("sched-high")
+          .long("sched-high")
+          .value_name("PERCENT")
+          .help("Heap occupancy at which it also keeps COMM local (default: 75)"))
+        .arg(Arg::new("batch")
+          .long("batch")
+          .value_name("K")
+          .help("Redexes prefetched and reduced together, 1 to 64 (default: 1)"))
+        .arg(Arg::new("oper-batch")
+          .long("oper-batch")
+          .value_name("N")
+          .help("Numeric operations evaluated together with SIMD, up to 256 (default: 0 = one at a time)"))
+        .arg(Arg::new("stats")
+          .long("stats")
+          .action(ArgAction::SetTrue)
+          .help("Print per-rule, failure, steal, link chain and allocator counters"))
+        .arg(Arg::new("profile")
+          .long("profile")
+          .value_name("FILE")
+          .help("Print calls and interactions per def, and write the call stacks to FILE in folded format"))
+        .arg(Arg::new("sample")
+          .long("sample")
+          .value_name("MS")
+          .help("Print throughput, busy threads, bag depths and heap use every MS milliseconds (default: 0 = never)"))
+        .arg(Arg::new("sample-file")
+          .long("sample-file")
+          .value_name("FILE")
+          .help("Write the samples to FILE instead of stderr"))
+        .arg(Arg::new("trace")
+          .long("trace")
+          .value_name("FILE")
+          .help("Write a timeline of each thread's busy, idle and sync spans, normalizations and IO calls to FILE (Chrome trace format)"))
+        .arg(Arg::new("report")
+          .long("report")
+          .value_name("FORMAT")
+          .value_parser(["text", "json"])
+          .help("Run report format: text, or json with peak heap and bag usage (default: text)"))
     )
     .subcommand(
       Command::new("run-cu")
@@ -53,7 +145,11 @@ fn main() {
         .arg(Arg::new("io")
           .long("io")
           .action(ArgAction::SetTrue)
-          .help("Generate with IO enabled")))
+          .help("Generate with IO enabled"))
+        .arg(Arg::new("hvm64")
+          .long("hvm64")
+          .action(ArgAction::SetTrue)
+          .help("Generate with 64-bit ports (compile with -latomic)")))
     .subcommand(
       Command::new("gen-cu")
         .about("Compiles a file (to standalone CUDA)")
@@ -67,9 +163,21 @@ fn main() {
   match matches.subcommand() {
     Some(("run", sub_matches)) => {
       let file = sub_matches.get_one::<String>("file").expect("required");
+      let load = std::time::Instant::now();
       let code = fs::read_to_string(file).expect("Unable to read file");
       let book = ast::Book::parse(&code).unwrap_or_else(|er| panic!("{}",er)).build();
-      run(&book);
+      let load = load.elapsed();
+      let heap = sub_matches.get_one::<String>("heap").map(|s| parse_size(s).unwrap_or_else(|| {
+        eprintln!("invalid value for --heap: {}", s);
+        std::process::exit(1);
+      }));
+      let threads = sub_matches.get_one::<String>("threads").cloned().or_else(|| std::env::var("HVM_THREADS").ok());
+      let threads = threads.map(|s| s.parse::<u32>().ok().filter(|&n| n > 0).unwrap_or_else(|| {
+        eprintln!("invalid thread count: {}", s);
+        std::process::exit(1);
+      }));
+      let json = sub_matches.get_one::<String>("report").is_some_and(|r| r == "json");
+      run(&book, heap, threads, json.then_some(load));
     }
     Some(("run-c", sub_matches)) => {
       let file = sub_matches.get_one::<String>("file").expect("required");
@@ -79,6 +187,7 @@ fn main() {
       book.to_buffer(&mut data);
       #[cfg(feature = "c")]
       unsafe {
+        set_c_opts(sub_matches);
         hvm_c(data.as_mut_ptr() as *mut u32);
       }
       #[cfg(not(feature = "c"))]
@@ -103,10 +212,6 @@ fn main() {
       let code = fs::read_to_string(file).expect("Unable to read file");
       let book = ast::Book::parse(&code).unwrap_or_else(|er| panic!("{}",er)).build();
 
-      // Gets optimal core count
-      let cores = num_cpus::get();
-      let tpcl2 = (cores as f64).log2().floor() as u32;
-
       // Generates the interpreted book
       let mut book_buf : Vec<u8> = Vec::new();
       book.to_buffer(&mut book_buf);
@@ -120,12 +225,20 @@ fn main() {
       let hvm_c = hvm_c.replace("#define INTERPRETED", "#define COMPILED");
       let hvm_c = hvm_c.replace("//COMPILED_BOOK_BUF//", &bookb);
       let hvm_c = hvm_c.replace("#define WITHOUT_MAIN", "#define WITH_MAIN");
-      let hvm_c = hvm_c.replace("#define TPC_L2 0", &format!("#define TPC_L2 {} // {} cores", tpcl2, cores));
+      let hvm64 = cfg!(feature = "hvm64") || sub_matches.get_flag("hvm64");
+      let hvm_c = if hvm64 { hvm_c.replace("//#define HVM64", "#define HVM64") } else { hvm_c };
+      let hvm_c = if cfg!(feature = "threaded-dispatch") { hvm_c.replace("//#define THREADED_DISPATCH", "#define THREADED_DISPATCH") } else { hvm_c };
       let hvm_c = format!("{hvm_c}\n\n{}", include_str!("run.c"));
       let hvm_c = hvm_c.replace(r#"#include "hvm.c""#, "");
       println!("{}", hvm_c);
     }
     Some(("gen-cu", sub_matches)) => {
+      // The CUDA runtime only has 32-bit ports
+      if cfg!(feature = "hvm64") {
+        eprintln!("gen-cu is not available in hvm64 builds");
+        std::process::exit(1);
+      }
+
       // Reads book from file
       let file = sub_matches.get_one::<String>("file").expect("required");
       let code = fs::read_to_string(file).expect("Unable to read file");
@@ -157,27 +270,74 @@ fn main() {
   }
 }
 
-pub fn run(book: &hvm::Book) {
+// Forwards the given runtime options to the C runtime.
+#[cfg(feature = "c")]
+fn set_c_opts(matches: &clap::ArgMatches) {
+  for key in C_OPTS {
+    let val = match matches.try_get_one::<bool>(key) {
+      Ok(flag) => flag.filter(|on| **on).map(|_| "1".to_string()),
+      Err(_)   => matches.get_one::<String>(key).cloned(),
+    };
+    if let Some(val) = val {
+      let k = CString::new(*key).unwrap();
+      let v = CString::new(val.as_str()).unwrap();
+      if !unsafe { hvm_c_opt(k.as_ptr(), v.as_ptr()) } {
+        eprintln!("invalid value for --{}: {}", key, val);
+        std::process::exit(1);
+      }
+    }
+  }
+}
+
+// Parses a size in bytes, with an optional K, M or G suffix.
+fn parse_size(str: &str) -> Option<usize> {
+  let str = str.trim_end_matches(['b', 'B']).trim_end_matches(['i', 'I']);
+  let (num, shift) = match str.chars().last()? {
+    'k' | 'K' => (&str[..str.len() - 1], 10),
+    'm' | 'M' => (&str[..str.len() - 1], 20),
+    'g' | 'G' => (&str[..str.len() - 1], 30),
+    _ => (str, 0),
+  };
+  num.parse::<usize>().ok()?.checked_mul(1 << shift)
+}
+
+// Prints the result, then either `- ITRS: ...` lines or, given the time taken
+// to load the book, a JSON report on one line of stderr.
+pub fn run(book: &hvm::Book, heap: Option<usize>, threads: Option<u32>, report: Option<std::time::Duration>) {
   // Initializes the global net
-  let net = hvm::GNet::new(0x2000000, 0x2000000);
+  let net = match heap {
+    Some(size) => hvm::GNet::with_heap(size),
+    None => hvm::GNet::new(hvm::HEAP_LEN, hvm::HEAP_LEN),
+  };
 
-  // Initializes threads
-  let mut tm = hvm::TMem::new(0, 1);
+  // Initializes threads, which claim chunks of the net as they need them
+  let tids = threads.unwrap_or_else(|| std::thread::available_parallelism().map_or(1, |n| n.get() as u32));
+  let tids = tids.min((net.node.len() / 2) as u32).max(1);
+  let mut tms: Vec<hvm::TMem> = (0..tids).map(|tid| hvm::TMem::new(tid, tids)).collect();
+  let sched = hvm::Sched::new(tids);
 
   // Creates an initial redex that calls main
   let main_id = book.defs.iter().position(|def| def.name == "main").unwrap();
-  tm.rbag.push_redex(hvm::Pair::new(hvm::Port::new(hvm::REF, main_id as u32), hvm::ROOT));
+  tms[0].rbag.push_redex(hvm::Pair::new(hvm::Port::new(hvm::REF, main_id as hvm::Val), hvm::ROOT));
   net.vars_create(hvm::ROOT.get_val() as usize, hvm::NONE);
 
   // Starts the timer
   let start = std::time::Instant::now();
+  let cpu = unsafe { clock() };
 
   // Evaluates
-  if !tm.evaluator(&net, &book) {
+  let ok = std::thread::scope(|scope| {
+    let runs: Vec<_> = tms.iter_mut().map(|tm| {
+      let (net, sched) = (&net, &sched);
+      scope.spawn(move || tm.evaluator(net, book, sched))
+    }).collect();
+    runs.into_iter().all(|run| run.join().unwrap())
+  });
+  if !ok {
     println!("Out of memory");
     return;
   }
-  
+
   // Stops the timer
   let duration = start.elapsed();
 
@@ -186,6 +346,10 @@ pub fn run(book: &hvm::Book) {
   // Prints the result
   if let Some(tree) = ast::Net::readback(&net, book) {
     println!("Result: {}", tree.show());
+    #[cfg(feature = "hvm64")]
+    if has_wide_numb(&tree.root) {
+      eprintln!("HVM: the result has numbers wider than u24/i24/f24, which 32-bit builds would have wrapped or rounded");
+    }
   } else {
     println!("Readback failed. Printing GNet memdump...\n");
     println!("{}", net.show());
@@ -193,7 +357,29 @@ pub fn run(book: &hvm::Book) {
 
   // Prints interactions and time
   let itrs = net.itrs.load(std::sync::atomic::Ordering::Relaxed);
-  println!("- ITRS: {}", itrs);
-  println!("- TIME: {:.2}s", duration.as_secs_f64());
-  println!("- MIPS: {:.2}", itrs as f64 / duration.as_secs_f64() / 1_000_000.0);
+  let mips = itrs as f64 / duration.as_secs_f64() / 1_000_000.0;
+  if let Some(load) = report {
+    let cpu = (unsafe { clock() } - cpu) as f64 / 1_000_000.0; // CLOCKS_PER_SEC
+    let peaks: Vec<String> = tms.iter().map(|tm| {
+      let (nodes, vars) = tm.span();
+      format!("{{\"nodes\": {}, \"vars\": {}, \"hbag\": {}, \"rbag\": {}}}", nodes, vars, tm.hmax, tm.rmax)
+    }).collect();
+    eprintln!("{{\"itrs\": {}, \"time\": {:.6}, \"cpu_time\": {:.6}, \"mips\": {:.2}, \"threads\": {}, \"book_load_time\": {:.6}, \"io_time\": 0, \"per_thread\": [{}]}}",
+      itrs, duration.as_secs_f64(), cpu, mips, tids, load.as_secs_f64(), peaks.join(", "));
+  } else {
+    println!("- ITRS: {}", itrs);
+    println!("- TIME: {:.2}s", duration.as_secs_f64());
+    println!("- MIPS: {:.2}", mips);
+  }
+}
+
+// True if a tree holds numbers that 32-bit builds would print differently.
+#[cfg(feature = "hvm64")]
+fn has_wide_numb(tree: &ast::Tree) -> bool {
+  match tree {
+    ast::Tree::Num { val } => !hvm::Numb(val.0).is_narrow(),
+    ast::Tree::Con { fst, snd } | ast::Tree::Dup { fst, snd } |
+    ast::Tree::Opr { fst, snd } | ast::Tree::Swi { fst, snd } => has_wide_numb(fst) || has_wide_numb(snd),
+    _ => false,
+  }
 }
@@ -1,7 +1,7 @@
+#include "hvm.c"
 #include <dlfcn.h>
 #include <errno.h>
 #include <stdio.h>
-#include "hvm.c"
 
 // Readback: λ-Encoded Ctr
 typedef struct Ctr {
@@ -182,10 +182,10 @@ Str readback_str(Net* net, Book* book, Port port) {
 /// Returns a λ-Encoded Ctr for a NIL: λt (t NIL)
 /// A previous call to `get_resources(tm, 0, 2, 1)` is required.
 Port inject_nil(Net* net) {
-  u32 v1 = tm[0]->vloc[0];
+  Loc v1 = tm[0]->vloc[0];
 
-  u32 n1 = tm[0]->nloc[0];
-  u32 n2 = tm[0]->nloc[1];
+  Loc n1 = tm[0]->nloc[0];
+  Loc n2 = tm[0]->nloc[1];
 
   vars_create(net, v1, NONE);
   Port var = new_port(VAR, v1);
@@ -199,12 +199,12 @@ Port inject_nil(Net* net) {
 /// Returns a λ-Encoded Ctr for a CONS: λt (((t CONS) head) tail)
 /// A previous call to `get_resources(tm, 0, 4, 1)` is required.
 Port inject_cons(Net* net, Port head, Port tail) {
-  u32 v1 = tm[0]->vloc[0];
+  Loc v1 = tm[0]->vloc[0];
 
-  u32 n1 = tm[0]->nloc[0];
-  u32 n2 = tm[0]->nloc[1];
-  u32 n3 = tm[0]->nloc[2];
-  u32 n4 = tm[0]->nloc[3];
+  Loc n1 = tm[0]->nloc[0];
+  Loc n2 = tm[0]->nloc[1];
+  Loc n3 = tm[0]->nloc[2];
+  Loc n4 = tm[0]->nloc[3];
 
   vars_create(net, v1, NONE);
   Port var = new_port(VAR, v1);
@@ -252,11 +252,11 @@ Port inject_ok(Net* net, Port val) {
     return new_port(ERA, 0);
   }
 
-  u32 v1 = tm[0]->vloc[0];
+  Loc v1 = tm[0]->vloc[0];
 
-  u32 n1 = tm[0]->nloc[0];
-  u32 n2 = tm[0]->nloc[1];
-  u32 n3 = tm[0]->nloc[2];
+  Loc n1 = tm[0]->nloc[0];
+  Loc n2 = tm[0]->nloc[1];
+  Loc n3 = tm[0]->nloc[2];
 
   vars_create(net, v1, NONE);
   Port var = new_port(VAR, v1);
@@ -275,11 +275,11 @@ Port inject_err(Net* net, Port err) {
     return new_port(ERA, 0);
   }
 
-  u32 v1 = tm[0]->vloc[0];
+  Loc v1 = tm[0]->vloc[0];
 
-  u32 n1 = tm[0]->nloc[0];
-  u32 n2 = tm[0]->nloc[1];
-  u32 n3 = tm[0]->nloc[2];
+  Loc n1 = tm[0]->nloc[0];
+  Loc n2 = tm[0]->nloc[1];
+  Loc n3 = tm[0]->nloc[2];
 
   vars_create(net, v1, NONE);
   Port var = new_port(VAR, v1);
@@ -299,10 +299,10 @@ Port inject_io_err(Net* net, IOError err) {
       return new_port(ERA, 0);
     }
 
-    u32 v1 = tm[0]->vloc[0];
+    Loc v1 = tm[0]->vloc[0];
 
-    u32 n1 = tm[0]->nloc[0];
-    u32 n2 = tm[0]->nloc[1];
+    Loc n1 = tm[0]->nloc[0];
+    Loc n2 = tm[0]->nloc[1];
 
     vars_create(net, v1, NONE);
     Port var = new_port(VAR, v1);
@@ -318,11 +318,11 @@ Port inject_io_err(Net* net, IOError err) {
     return new_port(ERA, 0);
   }
 
-  u32 v1 = tm[0]->vloc[0];
+  Loc v1 = tm[0]->vloc[0];
 
-  u32 n1 = tm[0]->nloc[0];
-  u32 n2 = tm[0]->nloc[1];
-  u32 n3 = tm[0]->nloc[2];
+  Loc n1 = tm[0]->nloc[0];
+  Loc n2 = tm[0]->nloc[1];
+  Loc n3 = tm[0]->nloc[2];
 
   vars_create(net, v1, NONE);
   Port var = new_port(VAR, v1);
@@ -606,8 +606,7 @@ Port io_get_time(Net* net, Book* book, Port argm) {
   u32 time_hi = (u32)(time_ns >> 24) & 0xFFFFFFF;
   u32 time_lo = (u32)(time_ns & 0xFFFFFFF);
   // Allocate a node to store the time
-  u32 lps = 0;
-  u32 loc = node_alloc_1(net, tm[0], &lps);
+  Loc loc = node_alloc_1(net, tm[0]);
   node_create(net, loc, new_pair(new_port(NUM, new_u24(time_hi)), new_port(NUM, new_u24(time_lo))));
 
   return inject_ok(net, new_port(CON, loc));
@@ -720,17 +719,17 @@ Port io_dl_close(Net* net, Book* book, Port argm) {
 // -----------
 
 void book_init(Book* book) {
-  book->ffns_buf[book->ffns_len++] = (FFn){"READ", io_read};
-  book->ffns_buf[book->ffns_len++] = (FFn){"OPEN", io_open};
-  book->ffns_buf[book->ffns_len++] = (FFn){"CLOSE", io_close};
-  book->ffns_buf[book->ffns_len++] = (FFn){"FLUSH", io_flush};
-  book->ffns_buf[book->ffns_len++] = (FFn){"WRITE", io_write};
-  book->ffns_buf[book->ffns_len++] = (FFn){"SEEK", io_seek};
-  book->ffns_buf[book->ffns_len++] = (FFn){"GET_TIME", io_get_time};
-  book->ffns_buf[book->ffns_len++] = (FFn){"SLEEP", io_sleep};
-  book->ffns_buf[book->ffns_len++] = (FFn){"DL_OPEN", io_dl_open};
-  book->ffns_buf[book->ffns_len++] = (FFn){"DL_CALL", io_dl_call};
-  book->ffns_buf[book->ffns_len++] = (FFn){"DL_CLOSE", io_dl_open};
+  book_add_ffn(book, "READ", io_read);
+  book_add_ffn(book, "OPEN", io_open);
+  book_add_ffn(book, "CLOSE", io_close);
+  book_add_ffn(book, "FLUSH", io_flush);
+  book_add_ffn(book, "WRITE", io_write);
+  book_add_ffn(book, "SEEK", io_seek);
+  book_add_ffn(book, "GET_TIME", io_get_time);
+  book_add_ffn(book, "SLEEP", io_sleep);
+  book_add_ffn(book, "DL_OPEN", io_dl_open);
+  book_add_ffn(book, "DL_CALL", io_dl_call);
+  book_add_ffn(book, "DL_CLOSE", io_dl_open);
 }
 
 // Monadic IO Evaluator
@@ -748,6 +747,11 @@ void do_run_io(Net* net, Book* book, Port port) {
     // Normalizes the net
     normalize(net, book);
 
+    // Compacts the net, if it got scattered over the heap
+    if (port == ROOT && net_fragmented(net)) {
+      net_compact(net);
+    }
+
     // Reads the λ-Encoded Ctr
     Ctr ctr = readback_ctr(net, book, peek(net, port));
 
@@ -789,11 +793,15 @@ void do_run_io(Net* net, Book* book, Port port) {
         if (ffn == NULL) {
           ret = inject_io_err_name(net);
         } else {
+          u64 ini = time64();
           ret = ffn->func(net, book, argm);
+          u64 dur = time64() - ini;
+          net->io_time += dur;
+          PROBE2(io_call, ffn->name, dur);
+          trace_span(TRACE_MAIN, TRACE_IO, ini, ffn - book->ffns_buf);
         };
 
-        u32 lps = 0;
-        u32 loc = node_alloc_1(net, tm[0], &lps);
+        Loc loc = node_alloc_1(net, tm[0]);
         node_create(net, loc, new_pair(ret, ROOT));
         boot_redex(net, new_pair(new_port(CON, loc), cont));
         port = ROOT;
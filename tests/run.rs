@@ -22,6 +22,104 @@ fn test_run_examples() {
   test_dir(&manifest_relative("examples/"));
 }
 
+#[test]
+fn test_report_json() {
+  let path = manifest_relative("tests/programs/list.hvm");
+  for cmd in ["run", "run-c"] {
+    println!("testing --report json, {cmd}...");
+    let output = Command::new(env!("CARGO_BIN_EXE_hvm"))
+      .args([cmd.as_ref(), path.as_os_str(), "--report".as_ref(), "json".as_ref()])
+      .output()
+      .unwrap();
+    assert!(output.status.success());
+
+    // The result stays alone on stdout, and the report takes one line of stderr
+    let stdout = String::from_utf8(output.stdout).unwrap();
+    let stderr = String::from_utf8(output.stderr).unwrap();
+    assert_eq!(stdout.lines().count(), 1, "{cmd}: unexpected stdout:\n{stdout}");
+    assert!(stdout.starts_with("Result: "), "{cmd}: unexpected stdout:\n{stdout}");
+    let report = stderr.lines().last().unwrap_or_default();
+    assert!(report.starts_with('{') && report.ends_with('}'), "{cmd}: unexpected report:\n{stderr}");
+    for key in ["itrs", "time", "cpu_time", "mips", "threads", "book_load_time", "io_time", "per_thread"] {
+      assert!(report.contains(&format!("\"{key}\": ")), "{cmd}: report lacks {key}:\n{report}");
+    }
+  }
+}
+
+#[test]
+fn test_io_compact() {
+  // Each IO step leaves a heap span of over 64K nodes, enough for `--compact 1`
+  let path = manifest_relative("tests/programs/io/compact.hvm");
+  println!("testing {path:?}, C without compaction...");
+  let plain =
+    execute_hvm(&["run-c".as_ref(), path.as_os_str(), "--compact".as_ref(), "0".as_ref()], true)
+      .unwrap();
+  println!("testing {path:?}, C compacting at every step...");
+  let compact =
+    execute_hvm(&["run-c".as_ref(), path.as_os_str(), "--compact".as_ref(), "1".as_ref()], true)
+      .unwrap();
+  assert_eq!(compact, plain, "{path:?}: output changes when the heap is compacted");
+}
+
+#[test]
+fn test_oper_batch() {
+  for file in ["numerics/u24.hvm", "numerics/i24.hvm", "numerics/f24.hvm", "numeric-casts.hvm"] {
+    let path = manifest_relative(&format!("tests/programs/{file}"));
+    println!("testing {path:?}, C with --oper-batch...");
+    let plain = execute_hvm(&["run-c".as_ref(), path.as_os_str()], false).unwrap();
+    let batch =
+      execute_hvm(&["run-c".as_ref(), path.as_os_str(), "--oper-batch".as_ref(), "16".as_ref()], false)
+        .unwrap();
+    assert_eq!(batch, plain, "{path:?}: output changes when OPER redexes are batched");
+  }
+}
+
+#[test]
+fn test_literal_range() {
+  // Literals that don't fit the numbers are rejected instead of wrapped
+  for typ in ["u24", "i24"] {
+    let path = manifest_relative(&format!("tests/programs/numerics/{typ}-range.hvm"));
+    for cmd in ["run", "run-c"] {
+      println!("testing {path:?}, {cmd}...");
+      let output = execute_hvm(&[cmd.as_ref(), path.as_os_str()], false).unwrap();
+      let error = format!("{typ} literal out of range");
+      assert!(!output.starts_with("Result: ") && output.contains(&error), "{path:?}: unexpected output:\n{output}");
+    }
+  }
+}
+
+#[test]
+fn test_profile() {
+  let path = manifest_relative("tests/programs/list.hvm");
+  let folded = std::env::temp_dir().join(format!("hvm-test-profile-{}.folded", std::process::id()));
+  println!("testing {path:?}, C with --profile...");
+  let output = Command::new(env!("CARGO_BIN_EXE_hvm"))
+    .args(["run-c".as_ref(), path.as_os_str(), "--threads".as_ref(), "1".as_ref()])
+    .args(["--profile".as_ref(), folded.as_os_str()])
+    .output()
+    .unwrap();
+  assert!(output.status.success());
+  let stdout = String::from_utf8(output.stdout).unwrap();
+  let itrs: u64 = stdout
+    .lines()
+    .find_map(|line| line.strip_prefix("- ITRS: "))
+    .and_then(|itrs| itrs.parse().ok())
+    .unwrap_or_else(|| panic!("no interaction count:\n{stdout}"));
+
+  // Each line is a call stack and the interactions done in it. With one thread,
+  // no redex is stolen, so every stack starts at main.
+  let stacks = fs::read_to_string(&folded).unwrap();
+  fs::remove_file(&folded).unwrap();
+  let mut total = 0;
+  for line in stacks.lines() {
+    let (stack, count) = line.rsplit_once(' ').unwrap_or_else(|| panic!("bad line: {line}"));
+    assert!(stack == "main" || stack.starts_with("main;"), "bad stack: {line}");
+    total += count.parse::<u64>().unwrap_or_else(|_| panic!("bad count: {line}"));
+  }
+  assert!(stacks.lines().any(|line| line.starts_with("main;List/Cons;map")), "missing calls:\n{stacks}");
+  assert_eq!(total, itrs, "the stacks don't add up to the interactions:\n{stacks}");
+}
+
 fn test_dir(dir: &Path) {
   insta::glob!(dir, "**/*.hvm", test_file)
 }
@@ -45,6 +143,15 @@ fn test_file(path: &Path) {
   let rust_output = execute_hvm(&["run".as_ref(), path.as_os_str()], false).unwrap();
   assert_snapshot!(rust_output);
 
+  println!("  testing {path:?}, Rust with 4 threads...");
+  let par_output =
+    execute_hvm(&["run".as_ref(), path.as_os_str(), "--threads".as_ref(), "4".as_ref()], false)
+      .unwrap();
+  assert_eq!(
+    par_output, rust_output,
+    "{path:?}: output with 4 threads does not match 1 thread"
+  );
+
   if contents.contains("@test-rust-only = 1") {
     println!("only testing rust implementation for {path:?}");
     return;